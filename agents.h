@@ -0,0 +1,300 @@
+#ifndef AGENTS_H
+#define AGENTS_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "population.h"
+#include "model.h"
+#include "rng.h"
+#include "sampling.h"
+#include "parallel.h"
+#include "ferry_queue.h"
+#include "records.h"
+#include "instrument.h"
+/*
+    __AGENT-BASED ENGINE__
+    The daily work is split into chunks of SWEEP_CHUNK consecutive agents, which can be handed to different threads.
+    Chunk c on day t draws its random numbers from its own substream (STREAM_SWEEP, t, c) and puts the agents that
+    join a queue into its own buffers; afterwards the buffers are appended to the ferry queues in chunk order. So the
+    queues end up in index order and the results are exactly the same whatever the number of threads.
+    The chunk size is fixed (not derived from the thread count) because it decides which random numbers each agent gets.
+*/
+const std::size_t SWEEP_CHUNK (1 << 16);
+typedef std::array<std::vector<uint32_t>, N_QUEUES> QueueBuffers; //agents that joined each queue, in index order
+
+/*
+    Draw the trips that start today for agents begin to end - 1. Every agent who is at home and not already standing in
+    a ferry queue has a chance of deciding to take a trip; if they do, we also draw the trip length and store it in the
+    population's trip_days array. Because one cannot take a vacation of length 0, a Poisson draw of 0 corresponds to not
+    going after all, so we draw "goes for at least a day" for everyone in one batch (sampling.h) and a zero-truncated
+    length only for the agents who go. The boolean indicates whether it is the peak season or not, as that affects the
+    chances of taking a trip.
+    Agents who are away or queued are left alone: we don't want to fuck with a vacation that is already happening.
+    Every agent uses up one uniform whether they can go or not, so agent i always gets word i of the chunk's stream,
+    and the length of their trip is word n + i (n agents in the chunk), read directly with at(). So what an agent draws
+    on a day only depends on who they are and on the day, not on what the agents before them did; scenarios that run
+    with the same stream give the same agent the same draws (common random numbers, see runScenarios in main.cpp).
+*/
+inline void getTripLengths(Population& world, std::size_t begin, std::size_t end, bool is_peak, RandomStream& randomizer,
+    SampleBuffers& buffers) {
+    std::size_t n = end - begin;
+    buffers.resize(n);
+    randomizer.fill(buffers.uniforms.data(), n);
+    sampleBernoulli(buffers.uniforms.data(), n, is_peak ? trip_start_peak : trip_start_nonpeak, buffers.draws.data());
+    const uint8_t* places = world.placeData();
+    const uint8_t* trip_days = world.tripData();
+    int64_t started = 0;
+    for (std::size_t m (0); m < n; ++m) {
+        if (!buffers.draws[m]) continue;
+        std::size_t i = begin + m;
+        bool at_home = ((places[i] ^ (places[i] >> 2)) & 3) == 0;
+        if (at_home && trip_days[i] == 0) { //trip_days is 0 for everyone at home and not queued
+            world.setTripDays(i, 1 + trip_length_sampler(randomizer.at(n + m)));
+            ++started;
+        }
+    }
+    count(COUNT_TRIPS_STARTED, started);
+}
+/*
+    Where will each Agent go on vacation? People from Vancouver pick one of the three coast communities in proportion
+    to their populations (the weights are in model.h), people from the coast always go to Vancouver. One batched
+    categorical draw per agent, so the weights are what they say.
+*/
+inline void getDestinations(Population& world, std::size_t begin, std::size_t end, RandomStream& randomizer) {
+    SampleBuffers buffers;
+    std::size_t n = end - begin;
+    buffers.resize(n);
+    randomizer.fill(buffers.uniforms.data(), n);
+    destination_sampler.sample(buffers.uniforms.data(), n, buffers.draws.data());
+    for (std::size_t m (0); m < n; ++m) {
+        std::size_t i = begin + m;
+        world.setDestination(i, world.getHome(i) == VANCOUVER ? static_cast<Place>(GIBSONS + buffers.draws[m]) : VANCOUVER);
+    }
+}
+/*
+    The daily sweep over agents begin to end - 1: agents who just decided to go and agents with no vacation days left
+    join a queue, everyone else who is away counts down one day. Agents at home go exactly when they have trip days and
+    agents who are away go home exactly when they have none, and the queue is a lookup in the routing table for this
+    bike path (see model.h), so there are no comparisons on the agent's attributes left in the loop.
+*/
+template <char bike_path>
+void sweepAgents(Population& world, std::size_t begin, std::size_t end, QueueBuffers& joined) {
+    const uint8_t* places = world.placeData();
+    int64_t returns = 0;
+    for (std::size_t k (begin); k < end; ++k) {
+        if (world.isQueued(k)) continue; //already waiting for a ferry
+        bool away = world.isOnVacation(k);
+        if (away == (world.getTripDays(k) > 0)) {
+            if (away) world.countDownTrip(k); //one vacation day over
+            continue;
+        }
+        joined[Routing<bike_path>::table.queue[places[k]]].push_back((uint32_t) k);
+        world.setQueued(k);
+        returns += away;
+    }
+    count(COUNT_RETURNS, returns);
+}
+inline void sweepAgents(Population& world, std::size_t begin, std::size_t end, char bike_path, QueueBuffers& joined) {
+    switch (bike_path) {
+        case 'r': sweepAgents<'r'>(world, begin, end, joined); break;
+        case 's': sweepAgents<'s'>(world, begin, end, joined); break;
+        default: sweepAgents<'n'>(world, begin, end, joined);
+    }
+}
+/*
+    Board up to capacity agents from the front of a ferry queue and return how many got on
+*/
+inline int boardFerry(PassengerQueue& queue, int capacity, Population& world) {
+    return (int) queue.popFront(capacity, [&](const uint32_t* agents, std::size_t n) {
+        world.boardAll(agents, n);
+    });
+}
+
+/*
+    Build the part of the population that is the same in every scenario: homes and destinations. In a batch this is
+    done once per iteration and shared by all the scenarios (see runScenarios).
+*/
+inline void buildBasePopulation(Population& world, RandomStream& randomizer, int n_threads, double fraction = 1.0) {
+    /*
+        Initialize agents. We keep them in a Population, which stores every agent in two bytes (see population.h).
+        We add agents to it in accordance with the population of the areas in question:
+        Sechelt, Gibsons, Roberts Creek, and Metro Vancouver.
+        The population of Metro Vancouver is ~2.64 million people. The population of Sechelt is ~10 thousand, Gibsons about 5 thousand,
+        and Roberts Creek about 3 thousand.
+        All agents for now are non-bikers, later we will randomly assign some of the agents to be bikers.
+        fraction < 1 builds a smaller world with the same proportions, for the benchmarks (bench.cpp).
+        Each area is one block of identical agents, so the arrays are allocated once and filled in bulk. An area of
+        x people gets ceil(x) agents, which is what adding agents while a counter is below x used to give.
+    */
+    const Place areas[4] = {VANCOUVER, SECHELT, GIBSONS, ROBERTS_CREEK}; //the order the agents have always been in
+    const double people[4] = {POPULATION_VANCOUVER, POPULATION_SECHELT, POPULATION_GIBSONS, POPULATION_ROBERTSCREEK};
+    std::size_t agents[4];
+    std::size_t total = world.size();
+    for (int a (0); a < 4; ++a) {
+        agents[a] = (std::size_t) std::ceil(people[a] * fraction);
+        total += agents[a];
+    }
+    world.reserve(total);
+    for (int a (0); a < 4; ++a) world.append(areas[a], NEVER_BIKES, agents[a]);
+
+    std::size_t n_chunks = (world.size() + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+    runInParallel((int) n_chunks, n_threads, [&](int c) {
+        RandomStream chunk_randomizer = randomizer.substream(STREAM_DESTINATIONS, c);
+        ScopedTimer timer(PHASE_DESTINATIONS);
+        getDestinations(world, c * SWEEP_CHUNK, std::min(world.size(), (c + 1) * SWEEP_CHUNK), chunk_randomizer);
+    });
+}
+/*
+    Once we know p_bike_if_lane we randomly assign some of the agents to be bike lane cyclists and some to be
+    die-hard cyclists. An agent is a die-hard with probability p_always_bike and otherwise a lane biker with probability
+    p_bike_if_lane, which is one categorical draw per agent from a single uniform, done in batches a chunk at a time
+    with the chunk's own substream (STREAM_BIKERS, c). The stream itself is not used up, so whatever comes after
+    assignBikers gets the same random numbers whether the agents were drawn here or loaded from a cache.
+    drawBikeTypes does the drawing for n_agents agents and hands agent i's type to set_bike(i, type), for engines that
+    keep their agents some other way (network_model.h).
+*/
+template <class SetBike>
+void drawBikeTypes(std::size_t n_agents, float p_bike_if_lane, float p_always_bike, const RandomStream& randomizer, SetBike set_bike) {
+    CategoricalSampler bike_type ({p_always_bike, (1.0 - p_always_bike) * p_bike_if_lane, (1.0 - p_always_bike) * (1.0 - p_bike_if_lane)});
+    const BikeType types[3] = {ALWAYS_BIKES, BIKES_IF_PATH, NEVER_BIKES}; //by category
+    SampleBuffers buffers;
+    for (std::size_t begin (0), c (0); begin < n_agents; begin += SWEEP_CHUNK, ++c) {
+        std::size_t n = std::min(SWEEP_CHUNK, n_agents - begin);
+        RandomStream chunk_randomizer = randomizer.substream(STREAM_BIKERS, c);
+        buffers.resize(n);
+        chunk_randomizer.fill(buffers.uniforms.data(), n);
+        bike_type.sample(buffers.uniforms.data(), n, buffers.draws.data());
+        for (std::size_t m (0); m < n; ++m) set_bike(begin + m, types[buffers.draws[m]]);
+    }
+}
+inline void assignBikers(Population& world, float p_bike_if_lane, float p_always_bike, const RandomStream& randomizer) {
+    drawBikeTypes(world.size(), p_bike_if_lane, p_always_bike, randomizer, [&](std::size_t i, BikeType type) {
+        world.setBike(i, type);
+    });
+}
+
+class Snapshot;
+
+/*
+    One iteration of the agent-based model, a day at a time. The population is the agents after assignBikers. Boarding
+    and balking use the same helpers as the other engines: BOARDING_ORDER, ferryCapacity and balks in model.h.
+    A copy of a model is a fork: it carries on from the same day with the same agents, queues and random numbers.
+    Together with setScenario that lets several scenarios share the days before they differ (see runScenarios), and
+    snapshot.h saves the whole state to a file and loads it back.
+*/
+class AgentModel {
+public:
+    AgentModel(Population population, const Scenario& parameters, const RandomStream& rng, int threads)
+        : british_columbia(std::move(population)), scenario(parameters), randomizer(rng), pool(threads) {
+        for (int q (0); q < N_QUEUES; ++q) {
+            trips[q] = 0;
+            balked[q] = 0;
+        }
+        std::size_t n_chunks = (british_columbia.size() + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+        joined.resize(n_chunks);
+        samples.resize(n_chunks);
+    }
+
+    /*
+        Day t; with a recorder every sailing is also recorded (see records.h)
+    */
+    void step(int t, SailingRecorder* recorder = nullptr) {
+        bool peak_season = isPeakSeason(t);
+        // logic for putting agents in ferries goes here
+        pool.run((int) joined.size(), [&](int c) {
+            RandomStream chunk_randomizer = randomizer.substream(STREAM_SWEEP, t, c);
+            std::size_t begin = c * SWEEP_CHUNK;
+            std::size_t end = std::min(british_columbia.size(), begin + SWEEP_CHUNK);
+            {
+                ScopedTimer timer(PHASE_TRIP_SAMPLING);
+                getTripLengths(british_columbia, begin, end, peak_season, chunk_randomizer, samples[c]);
+            }
+            ScopedTimer timer(PHASE_ROUTING);
+            sweepAgents(british_columbia, begin, end, scenario.bike_path, joined[c]);
+        });
+        {
+            ScopedTimer timer(PHASE_ROUTING);
+            int64_t balked_today = 0;
+            for (QueueBuffers& chunk : joined) { //merge in chunk order, so the queues are in index order
+                for (int q (0); q < N_QUEUES; ++q) {
+                    if (scenario.balk_length == 0) ferry_queues[q].append(chunk[q].data(), chunk[q].size());
+                    else for (uint32_t k : chunk[q]) {
+                        if (balks(ferry_queues[q].size(), scenario)) {
+                            british_columbia.balk(k);
+                            ++balked[q];
+                            ++balked_today;
+                        }
+                        else ferry_queues[q].push_back(k);
+                    }
+                    chunk[q].clear();
+                }
+            }
+            count(COUNT_BALKS, balked_today);
+            for (int q (0); q < N_QUEUES; ++q) recordQueueLength((FerryQueue) q, (int64_t) ferry_queues[q].size());
+        }
+        /*
+            Board each ferry up to its capacity, queue by queue in BOARDING_ORDER. boardFerry sends agents who were at
+            home to their destination and agents who were on vacation back home.
+        */
+        ScopedTimer timer(PHASE_BOARDING);
+        int64_t boarded_today = 0;
+        for (int i (0); i < scenario.ferries_per_day; ++i) {
+            for (FerryQueue q : BOARDING_ORDER) {
+                int passengers = boardFerry(ferry_queues[q], ferryCapacity(q, scenario), british_columbia);
+                trips[q] += passengers;
+                boarded_today += passengers;
+                if (recorder) recorder->sailed(t, i, q, passengers, (int64_t) ferry_queues[q].size(), balked[q]);
+            }
+        }
+        count(COUNT_BOARDED, boarded_today);
+    }
+
+    /*
+        Cumulative number of agents carried by each queue's ferries, e.g. tripsBoarded(QUEUE_CVG) is car trips to the coast
+    */
+    int64_t tripsBoarded(FerryQueue q) const {
+        return trips[q];
+    }
+    int64_t queueLength(FerryQueue q) const {
+        return (int64_t) ferry_queues[q].size();
+    }
+    int64_t tripsBalked(FerryQueue q) const {
+        return balked[q];
+    }
+    const Population& population() const {
+        return british_columbia;
+    }
+    /*
+        Run the remaining days with other parameters. The population keeps the bikers it was built with, so only the
+        bike path, the ferries and the balk point can really change.
+    */
+    void setScenario(const Scenario& parameters) {
+        scenario = parameters;
+    }
+    const Scenario& parameters() const {
+        return scenario;
+    }
+
+private:
+    friend class Snapshot;
+
+    Population british_columbia;
+    Scenario scenario;
+    RandomStream randomizer;
+    ThreadPool pool; //for the daily sweep, the same workers every day
+    /*
+        Define ferry queues. These hold indices rather than agents, which are more computationally costly, in a
+        ring buffer so that joining at the back and boarding from the front are cheap (see ferry_queue.h)
+    */
+    PassengerQueue ferry_queues[N_QUEUES]; //indexed by FerryQueue, see model.h
+    int64_t trips[N_QUEUES]; //cumulative passengers of each queue
+    int64_t balked[N_QUEUES]; //agents who found a queue too long, see balks() in model.h
+    std::vector<QueueBuffers> joined; //per sweep chunk
+    std::vector<SampleBuffers> samples;
+};
+
+#endif // AGENTS_H
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "agents.h"
+#include "cohort.h"
+#include "events.h"
+#include "parallel.h"
+#include "statistics.h"
+/*
+    __BENCHMARKS__
+    A program of its own, so the simulation does not pay for the allocation counter:
+
+        g++ -O2 -pthread bench.cpp -o bench
+        ./bench [--threads N] BASELINE_FILE
+        ./bench --check
+
+    It times the hot paths of the model on fixed fixtures, so two builds can be compared:
+    - each stage of the agent-based day on its own (destinations, trip draws, routing sweep, boarding), and
+    - a whole simulated year with each engine,
+    at several population sizes. MODEL_SCALE is a compile-time constant that does not change the number of agents, so
+    the sizes are fractions of the real population built with buildBasePopulation(..., fraction). The fixtures come
+    from BENCH_SEED, not from --seed, so every run times exactly the same work.
+    Every benchmark reports nanoseconds per unit of work (an agent, an agent-day or a passenger, see the table), heap
+    allocations per repetition and the peak resident set size while it ran. If FILE exists it is the baseline: every
+    benchmark is compared with it and the run fails if anything got more than BENCH_TOLERANCE slower. If it does not
+    exist this run becomes the baseline.
+    --check runs the statistical checks instead (see runChecks): samplers and engines compared with what they should
+    give, which a benchmark would not notice when they are fast and wrong.
+*/
+
+const uint64_t BENCH_SEED (20240611);
+const double BENCH_TOLERANCE (0.10);
+
+/*
+    Heap allocation counter. Replacing the global operator new is the only way to see the allocations made inside the
+    standard library; it costs one relaxed atomic add per allocation.
+*/
+std::atomic<uint64_t> allocation_count (0);
+
+//none of these are inlined, otherwise GCC sees malloc() matched with operator delete or new with free() and warns about it
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    void* p = std::malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+/*
+    Peak resident set size in MB since the last resetPeakMemory(). Both only work on Linux; elsewhere the peak is 0.
+*/
+void resetPeakMemory() {
+#ifdef __linux__
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5"; //resets the high water mark, see proc(5)
+#endif
+}
+double peakMemoryMB() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::atof(line.c_str() + 6) / 1024.0;
+    }
+#endif
+    return 0.0;
+}
+
+struct BenchResult {
+    std::string name;
+    std::string unit;
+    double ns_per_unit;
+    double allocations; //per repetition
+    double peak_mb;
+};
+
+/*
+    Time body() after setup() until at least min_seconds have been timed (and at least once, at most max_reps times),
+    and keep the fastest repetition. units is the amount of work in one body(), e.g. agents times days.
+*/
+BenchResult measure(const std::string& name, const std::string& unit, double units, std::function<void()> setup,
+    std::function<void()> body, double min_seconds = 0.5, int max_reps = 20) {
+    resetPeakMemory();
+    double best = 1e300;
+    double timed = 0.0;
+    uint64_t allocations = 0;
+    int reps = 0;
+    while (reps < max_reps && (reps == 0 || timed < min_seconds)) {
+        setup();
+        uint64_t before = allocation_count.load();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        allocations += allocation_count.load() - before;
+        best = std::min(best, seconds);
+        timed += seconds;
+        ++reps;
+    }
+    return {name, unit, best * 1e9 / units, (double) allocations / reps, peakMemoryMB()};
+}
+
+std::map<std::string, double> readBaseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    std::string name;
+    double ns;
+    while (in >> name >> ns) baseline[name] = ns;
+    return baseline;
+}
+
+/*
+    Run every benchmark and compare with (or write) the baseline. Returns the exit code for main().
+*/
+int runBenchmarks(const std::string& baseline_path, int n_threads) {
+    const double fractions[] = {0.01, 0.1, 1.0};
+    const int WARM_UP_DAYS = 30; //from the start of the peak season, so some agents are away and some are queued
+    Scenario scenario;
+    scenario.bike_path = 's';
+    scenario.p_bike_if_lane = 0.3;
+    std::vector<BenchResult> results;
+
+    for (double fraction : fractions) {
+        std::string size = std::to_string((int) (fraction * 100)) + "%";
+        //the fixtures: a fresh base population, and the same population after a few weeks of the peak season
+        RandomStream randomizer(BENCH_SEED, 0);
+        Population base;
+        buildBasePopulation(base, randomizer, 1, fraction);
+        Population warm = base;
+        assignBikers(warm, scenario.p_bike_if_lane, scenario.p_always_bike, randomizer);
+        {
+            AgentModel model(warm, scenario, randomizer, n_threads);
+            for (int t (PEAK_SEASON_START); t < PEAK_SEASON_START + WARM_UP_DAYS; ++t) model.step(t);
+            warm = model.population();
+        }
+        double n = (double) base.size();
+        std::size_t n_chunks = (base.size() + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+        Population world;
+        std::vector<QueueBuffers> joined (n_chunks);
+        std::vector<SampleBuffers> samples (n_chunks);
+        auto chunkEnd = [&](std::size_t c) {
+            return std::min(world.size(), (c + 1) * SWEEP_CHUNK);
+        };
+
+        results.push_back(measure("destinations/" + size, "agent", n, [&]() {
+            world = base;
+        }, [&]() {
+            for (std::size_t c (0); c < n_chunks; ++c) {
+                RandomStream chunk_randomizer = randomizer.substream(STREAM_DESTINATIONS, c);
+                getDestinations(world, c * SWEEP_CHUNK, chunkEnd(c), chunk_randomizer);
+            }
+        }));
+        results.push_back(measure("trip_draws/" + size, "agent-day", n, [&]() {
+            world = warm;
+        }, [&]() {
+            for (std::size_t c (0); c < n_chunks; ++c) {
+                RandomStream chunk_randomizer = randomizer.substream(STREAM_SWEEP, 0, c);
+                getTripLengths(world, c * SWEEP_CHUNK, chunkEnd(c), true, chunk_randomizer, samples[c]);
+            }
+        }));
+        results.push_back(measure("routing/" + size, "agent-day", n, [&]() {
+            world = warm;
+            for (std::size_t c (0); c < n_chunks; ++c) {
+                RandomStream chunk_randomizer = randomizer.substream(STREAM_SWEEP, 0, c);
+                getTripLengths(world, c * SWEEP_CHUNK, chunkEnd(c), true, chunk_randomizer, samples[c]);
+                for (std::vector<uint32_t>& queue : joined[c]) queue.clear();
+            }
+        }, [&]() {
+            for (std::size_t c (0); c < n_chunks; ++c) sweepAgents(world, c * SWEEP_CHUNK, chunkEnd(c), scenario.bike_path, joined[c]);
+        }));
+        //boarding: everyone at home is in one queue and boards in ferry-sized groups
+        PassengerQueue everyone;
+        std::vector<uint32_t> at_home;
+        for (std::size_t i (0); i < warm.size(); ++i) {
+            if (!warm.isOnVacation(i) && !warm.isQueued(i)) at_home.push_back((uint32_t) i);
+        }
+        results.push_back(measure("boarding/" + size, "passenger", (double) at_home.size(), [&]() {
+            world = warm;
+            everyone = PassengerQueue();
+            everyone.append(at_home.data(), at_home.size());
+        }, [&]() {
+            while (!everyone.empty()) boardFerry(everyone, scenario.cars_per_ferry, world);
+        }));
+
+        //a whole year, per agent-day of the population simulated
+        int t_max = 365;
+        bool full = fraction == 1.0; //the full population takes several seconds a year with the agent engine, time it once
+        results.push_back(measure("year/agent/" + size, "agent-day", n * t_max, []() {}, [&]() {
+            Population people = base;
+            RandomStream year_randomizer(BENCH_SEED, 1);
+            assignBikers(people, scenario.p_bike_if_lane, scenario.p_always_bike, year_randomizer);
+            AgentModel model(std::move(people), scenario, year_randomizer, n_threads);
+            for (int t (0); t < t_max; ++t) model.step(t);
+        }, full ? 0.0 : 0.5, full ? 1 : 20));
+        results.push_back(measure("year/event/" + size, "agent-day", n * t_max, []() {}, [&]() {
+            Population people = base;
+            RandomStream year_randomizer(BENCH_SEED, 1);
+            assignBikers(people, scenario.p_bike_if_lane, scenario.p_always_bike, year_randomizer);
+            EventModel model(people, scenario, t_max, year_randomizer);
+            for (int t (0); t < t_max; ++t) model.step(t);
+        }));
+        if (full) { //the cohort engine always simulates the full population
+            results.push_back(measure("year/cohort/" + size, "agent-day", n * t_max, []() {}, [&]() {
+                CohortModel model(scenario, RandomStream(BENCH_SEED, 1));
+                for (int t (0); t < t_max; ++t) model.step(t);
+            }));
+        }
+    }
+
+    std::map<std::string, double> baseline = readBaseline(baseline_path);
+    bool slower = false;
+    std::printf("%-22s %12s %-10s %12s %9s %12s %8s\n", "benchmark", "ns", "per", "allocs/rep", "peak MB", "baseline ns", "change");
+    for (const BenchResult& r : results) {
+        std::printf("%-22s %12.3f %-10s %12.0f %9.1f", r.name.c_str(), r.ns_per_unit, r.unit.c_str(), r.allocations, r.peak_mb);
+        auto found = baseline.find(r.name);
+        if (found == baseline.end()) {
+            std::printf(" %12s %8s\n", "-", "-");
+            continue;
+        }
+        double change = r.ns_per_unit / found->second - 1.0;
+        std::printf(" %12.3f %+7.1f%%%s\n", found->second, 100.0 * change, change > BENCH_TOLERANCE ? "  SLOWER" : "");
+        if (change > BENCH_TOLERANCE) slower = true;
+    }
+    if (baseline.empty()) {
+        std::ofstream out(baseline_path);
+        for (const BenchResult& r : results) out << r.name << " " << r.ns_per_unit << "\n";
+        if (!out) {
+            std::cerr << "Could not write the baseline " << baseline_path << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote the baseline " << baseline_path << std::endl;
+        return 0;
+    }
+    if (slower) {
+        std::cout << "Slower than the baseline by more than " << 100 * BENCH_TOLERANCE << "%" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    Prints one line per check and whether it passed; gives false if it did not
+*/
+bool reportCheck(const std::string& name, double found, double expected, double tolerance) {
+    bool passed = std::fabs(found - expected) <= tolerance;
+    std::printf("%-44s %14.4f %14.4f %12.4f  %s\n", name.c_str(), found, expected, tolerance, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+/*
+    The mean and variance of sampleHypergeometric (cohort.h) against the exact ones, from small draws to the
+    ferry-sized and balk-sized draws of the cohort engine. The tolerances are five standard errors of the estimates.
+*/
+bool checkHypergeometric() {
+    const int64_t cases[][3] = {{20, 7, 5}, {200, 150, 60}, {6600, 2000, 3000}, {20000, 8000, 9000},
+        {2640000, 370, 100000}, {2640000, 900000, 1500000}, {1000000000, 300000000, 400000000}};
+    const int N_SAMPLES = 20000;
+    RandomStream randomizer(BENCH_SEED, 2);
+    bool passed = true;
+    for (const int64_t* c : cases) {
+        double n = (double) c[0], k = (double) c[1], d = (double) c[2];
+        double mean = d * k / n;
+        double variance = d * (k / n) * (1 - k / n) * (n - d) / (n - 1);
+        RunningStats stats;
+        for (int i (0); i < N_SAMPLES; ++i) stats.add((double) sampleHypergeometric(c[0], c[1], c[2], randomizer));
+        std::string name = "hypergeometric(" + std::to_string(c[0]) + "," + std::to_string(c[1]) + "," + std::to_string(c[2]) + ")";
+        passed &= reportCheck(name + " mean", stats.mean(), mean, 5 * std::sqrt(variance / N_SAMPLES));
+        passed &= reportCheck(name + " var", stats.variance(), variance, 5 * variance * std::sqrt(2.0 / (N_SAMPLES - 1)));
+    }
+    return passed;
+}
+
+/*
+    The cohort engine against the event engine with a balk point that is reached and large ferries, so that the
+    balking and boarding draws of the cohort engine are thousands of agents out of groups of thousands: which cells
+    get through shows in where the visitors are. Compares each (destination, willingness to bike) cell's share of the
+    visitor-days of the year, sampled weekly, and the share of trips that balk, over BALK_ITERATIONS iterations of
+    each engine; the tolerances are five standard errors of the difference.
+*/
+bool checkBalkMix() {
+    const int BALK_ITERATIONS = 8;
+    const int t_max = 365;
+    Scenario scenario;
+    scenario.bike_path = 's';
+    scenario.p_bike_if_lane = 0.3;
+    scenario.cars_per_ferry = 2000;
+    scenario.bikes_per_ferry = 2000;
+    scenario.balk_length = 50000;
+    const Place places[4] = {VANCOUVER, GIBSONS, ROBERTS_CREEK, SECHELT};
+    std::vector<RunningStats> shares[2]; //cohort, event; by place * 3 + BikeType, then the balked share
+    for (std::vector<RunningStats>& engine : shares) engine.resize(4 * 3 + 1);
+    auto addYear = [&](std::vector<RunningStats>& engine, auto& model) {
+        double days[4 * 3] = {};
+        double total = 0.0;
+        for (int t (0); t < t_max; ++t) {
+            model.step(t);
+            if (t % 7 != 0) continue;
+            for (int p (0); p < 4; ++p) {
+                for (int b (NEVER_BIKES); b <= BIKES_IF_PATH; ++b) days[p * 3 + b] += model.visitors(places[p], (BikeType) b);
+            }
+        }
+        for (double d : days) total += d;
+        for (int c (0); c < 4 * 3; ++c) engine[c].add(days[c] / total);
+        int64_t boarded = 0, balked = 0;
+        for (int q (0); q < N_QUEUES; ++q) {
+            boarded += model.tripsBoarded((FerryQueue) q);
+            balked += model.tripsBalked((FerryQueue) q);
+        }
+        engine.back().add((double) balked / (balked + boarded));
+    };
+    Population base;
+    RandomStream base_randomizer(BENCH_SEED, 3);
+    buildBasePopulation(base, base_randomizer, 1);
+    for (int n (0); n < BALK_ITERATIONS; ++n) {
+        RandomStream randomizer(BENCH_SEED, 4 + n);
+        CohortModel cohort(scenario, randomizer);
+        addYear(shares[0], cohort);
+        Population people = base;
+        assignBikers(people, scenario.p_bike_if_lane, scenario.p_always_bike, randomizer);
+        EventModel events(people, scenario, t_max, randomizer);
+        addYear(shares[1], events);
+    }
+    const char* place_names[4] = {"vancouver", "gibsons", "roberts_creek", "sechelt"};
+    const char* bike_names[3] = {"never", "always", "if_lane"};
+    bool passed = true;
+    for (std::size_t c (0); c < shares[0].size(); ++c) {
+        const RunningStats& cohort = shares[0][c];
+        const RunningStats& events = shares[1][c];
+        std::string name = c + 1 < shares[0].size() ? std::string("balk mix visitors ") + place_names[c / 3] + "/" + bike_names[c % 3]
+            : std::string("balk mix balked share");
+        double error = std::sqrt((cohort.variance() + events.variance()) / BALK_ITERATIONS);
+        passed &= reportCheck(name, cohort.mean(), events.mean(), std::max(5 * error, 1e-4));
+    }
+    return passed;
+}
+
+/*
+    Every check; the exit code for main()
+*/
+int runChecks() {
+    std::printf("%-44s %14s %14s %12s\n", "check", "found", "expected", "tolerance");
+    bool passed = checkHypergeometric();
+    passed &= checkBalkMix();
+    std::cout << (passed ? "All checks passed" : "Some checks FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    int n_threads = defaultThreadCount();
+    std::string baseline_path;
+    for (int i (1); i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--check" && argc == 2) return runChecks();
+        if (option == "--threads" && i + 1 < argc) n_threads = std::max(1, std::atoi(argv[++i]));
+        else if (option.compare(0, 2, "--") != 0 && baseline_path.empty()) baseline_path = option;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] BASELINE_FILE" << std::endl;
+            std::cerr << "       " << argv[0] << " --check" << std::endl;
+            return 1;
+        }
+    }
+    if (baseline_path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] BASELINE_FILE" << std::endl;
+        return 1;
+    }
+    return runBenchmarks(baseline_path, n_threads);
+}
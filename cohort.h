@@ -0,0 +1,346 @@
+#ifndef COHORT_H
+#define COHORT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+#include "population.h"
+#include "model.h"
+#include "records.h"
+#include "instrument.h"
+/*
+    __COHORT ENGINE__
+    Agents with the same home, destination and willingness to bike are interchangeable, so instead of simulating every
+    agent we can keep one count per cell (type of agent, where they are, how many vacation days they have left) and
+    draw binomial and multinomial variates for the whole cell at once. The cost of a day then depends on the number of
+    cells and on the ferry capacity, not on the size of the population, so MODEL_SCALE = 1 runs just as fast as any other.
+
+    The engine follows the same rules as the agent-based engine (AgentModel in agents.h), in the same order:
+    1. Agents at home start a trip with probability takes_trip_*, with a Poisson(n_days) length; a length of 0 means no trip.
+    2. In the order the agents are stored in (Vancouver, Sechelt, Gibsons, Roberts Creek) they join the ferry queues:
+       new trips join the outbound queue, agents with no vacation days left join the return queue, and everyone else
+       who is away counts down one day.
+    3. Each ferry boards its queues in the order bike to coast, bike to Vancouver, car to Vancouver, car to coast
+       (BOARDING_ORDER in model.h).
+    Everyone who joins a queue on the same day from the same home is in one group, in random order with respect to
+    each other. When a ferry only has room for part of a group, the passengers are a multivariate hypergeometric
+    draw from it. The same goes for a group that finds the queue close to the balk point: the ones who still fit in
+    the queue are a hypergeometric draw and the rest balk.
+    The trips of cell c on day t are drawn from the substream (STREAM_COHORT_TRIPS, t, c) and the balking and boarding
+    at queue q on day t from (STREAM_COHORT_QUEUES, t, q), so a difference between two scenarios in one queue does not
+    shift the draws of every other cell and day (common random numbers, see runScenarios in main.cpp).
+*/
+
+/*
+    Hypergeometric variate: the number of successes in draws picks without replacement from total items, of which
+    successes are successes. Inversion from the mode outwards, always to the more likely neighbour, with each
+    probability the ratio of the one next to it: the mode is the one value computed from logarithms (P(mode) is never
+    tiny), the walk usually ends within a few standard deviations of it, and far in the tails, where the probabilities
+    underflow, nothing is left to walk for.
+*/
+template <class Rng>
+int64_t sampleHypergeometric(int64_t total, int64_t successes, int64_t draws, Rng& rng) {
+    if (draws <= 0 || successes <= 0) return 0;
+    if (draws >= total) return successes;
+    if (successes >= total) return draws;
+    int64_t failures = total - successes;
+    int64_t k_min = std::max<int64_t>(0, draws - failures);
+    int64_t k_max = std::min(successes, draws);
+    int64_t mode = (int64_t) ((double(draws) + 1) * (double(successes) + 1) / (double(total) + 2));
+    mode = std::min(std::max(mode, k_min), k_max);
+    auto logChoose = [](int64_t n, int64_t k) {
+        return std::lgamma(n + 1.0) - std::lgamma(k + 1.0) - std::lgamma(n - k + 1.0);
+    };
+    double p_mode = std::exp(logChoose(successes, mode) + logChoose(failures, draws - mode) - logChoose(total, draws));
+    double u = std::uniform_real_distribution<>(0.0, 1.0)(rng) - p_mode;
+    if (u <= 0) return mode;
+    int64_t below = mode, above = mode;
+    double p_below = p_mode, p_above = p_mode;
+    while (below > k_min || above < k_max) {
+        double next_below = below > k_min ? p_below * double(below) * double(failures - draws + below)
+            / (double(successes - below + 1) * double(draws - below + 1)) : 0.0;
+        double next_above = above < k_max ? p_above * double(successes - above) * double(draws - above)
+            / (double(above + 1) * double(failures - draws + above + 1)) : 0.0;
+        if (next_below == 0.0 && next_above == 0.0) break; //both tails underflowed
+        if (next_above >= next_below) {
+            p_above = next_above;
+            ++above;
+            u -= p_above;
+            if (u <= 0) return above;
+        }
+        else {
+            p_below = next_below;
+            --below;
+            u -= p_below;
+            if (u <= 0) return below;
+        }
+    }
+    return mode; //u was left over from rounding
+}
+
+class CohortModel {
+public:
+    /*
+        Build the population as counts. The three-way split into bike types and the split of Vancouverites over the
+        three destinations are multinomial, which is what the per-agent draws in assignBikers (agents.h) add up to.
+    */
+    CohortModel(const Scenario& parameters, const RandomStream& rng) : scenario(parameters), randomizer(rng), queue_randomizers(N_QUEUES, rng) {
+        for (int c (0); c < N_CELLS; ++c) {
+            at_home[c] = 0;
+            for (int t (0); t <= Population::MAX_TRIP_DAYS; ++t) away[c][t] = 0;
+        }
+        for (int q (0); q < N_QUEUES; ++q) {
+            boarded[q] = 0;
+            balked[q] = 0;
+            length[q] = 0;
+        }
+        const double populations[4] = {POPULATION_VANCOUVER, POPULATION_GIBSONS, POPULATION_ROBERTSCREEK, POPULATION_SECHELT};
+        for (int h (VANCOUVER); h <= SECHELT; ++h) {
+            int64_t n = (int64_t) std::ceil(populations[h]); //as many agents as buildBasePopulation (agents.h) gives the area
+            int64_t die_hard = binomial(n, scenario.p_always_bike, randomizer);
+            int64_t lane = binomial(n - die_hard, scenario.p_bike_if_lane, randomizer);
+            int64_t by_type[3] = {n - die_hard - lane, die_hard, lane}; //indexed by BikeType
+            for (int b (NEVER_BIKES); b <= BIKES_IF_PATH; ++b) {
+                if (h != VANCOUVER) {
+                    at_home[cell((Place) h, VANCOUVER, (BikeType) b)] = by_type[b];
+                    continue;
+                }
+                int64_t left = by_type[b];
+                double weight_left = 1.0;
+                for (int dst (GIBSONS); dst <= SECHELT; ++dst) {
+                    double w = weights[dst - GIBSONS];
+                    int64_t k = (dst == SECHELT) ? left : binomial(left, w / weight_left, randomizer);
+                    at_home[cell(VANCOUVER, (Place) dst, (BikeType) b)] = k;
+                    left -= k;
+                    weight_left -= w;
+                }
+            }
+        }
+        /*
+            Zero-truncated Poisson trip lengths, so a trip start can be drawn directly as "goes with length L".
+            conditional[L] is the chance a trip is L days long given that it is not shorter.
+        */
+        double mean = n_days.mean();
+        double pmf = std::exp(-mean);
+        p_zero_length = pmf;
+        double tail = 1.0 - pmf;
+        for (int L (1); L <= Population::MAX_TRIP_DAYS; ++L) {
+            pmf *= mean / L;
+            conditional[L] = (L == Population::MAX_TRIP_DAYS || tail <= 0.0) ? 1.0 : std::min(1.0, pmf / tail);
+            tail -= pmf;
+        }
+    }
+
+    /*
+        One day; with a recorder every sailing is also recorded (see records.h)
+    */
+    void step(int t, SailingRecorder* recorder = nullptr) {
+        bool is_peak = isPeakSeason(t);
+        double p_go = (is_peak ? takes_trip_peak.p() : takes_trip_nonpeak.p()) * (1.0 - p_zero_length);
+        for (int q (0); q < N_QUEUES; ++q) queue_randomizers[q] = randomizer.substream(STREAM_COHORT_QUEUES, t, q);
+        {
+            ScopedTimer timer(PHASE_ROUTING); //the trips of the day are drawn in here too, a cell at a time
+            int64_t balked_before = 0;
+            for (int q (0); q < N_QUEUES; ++q) balked_before += balked[q];
+            for (Place home : HOME_ORDER) {
+                Group joining[N_QUEUES];
+                for (int c (cell(home, VANCOUVER, NEVER_BIKES)); c < cell(home, VANCOUVER, NEVER_BIKES) + CELLS_PER_HOME; ++c) {
+                    Place destination = cellDestination(c);
+                    if (destination == home) continue; //not a real cell
+                    BikeType will_bike = cellBike(c);
+                    RandomStream cell_randomizer = randomizer.substream(STREAM_COHORT_TRIPS, t, c);
+                    //trips that start today, with their lengths
+                    int64_t starting = binomial(at_home[c], p_go, cell_randomizer);
+                    count(COUNT_TRIPS_STARTED, starting);
+                    if (starting > 0) {
+                        at_home[c] -= starting;
+                        FerryQueue q = chooseQueue(home, home, destination, will_bike, false, scenario.bike_path);
+                        for (int L (1); L <= Population::MAX_TRIP_DAYS && starting > 0; ++L) {
+                            int64_t k = binomial(starting, conditional[L], cell_randomizer);
+                            joining[q].add(c, L, k);
+                            starting -= k;
+                        }
+                    }
+                    //people with no vacation left go home, everyone else who is away counts down a day
+                    int64_t stuck = 0;
+                    if (away[c][0] > 0) {
+                        FerryQueue q = chooseQueue(home, destination, destination, will_bike, true, scenario.bike_path);
+                        if (q == NO_QUEUE) stuck = away[c][0];
+                        else {
+                            joining[q].add(c, 0, away[c][0]);
+                            count(COUNT_RETURNS, away[c][0]);
+                        }
+                    }
+                    for (int t (0); t < Population::MAX_TRIP_DAYS; ++t) away[c][t] = away[c][t + 1];
+                    away[c][Population::MAX_TRIP_DAYS] = 0;
+                    away[c][0] += stuck;
+                }
+                for (int q (0); q < N_QUEUES; ++q) {
+                    if (scenario.balk_length > 0) balk((FerryQueue) q, joining[q]);
+                    if (joining[q].size > 0) {
+                        length[q] += joining[q].size;
+                        queues[q].push_back(joining[q]);
+                    }
+                }
+            }
+            int64_t balked_after = 0;
+            for (int q (0); q < N_QUEUES; ++q) {
+                balked_after += balked[q];
+                recordQueueLength((FerryQueue) q, length[q]);
+            }
+            count(COUNT_BALKS, balked_after - balked_before);
+        }
+        ScopedTimer timer(PHASE_BOARDING);
+        int64_t boarded_today = 0;
+        for (int i (0); i < scenario.ferries_per_day; ++i) {
+            for (FerryQueue q : BOARDING_ORDER) {
+                int64_t passengers = boardFerry(q, ferryCapacity(q, scenario));
+                boarded[q] += passengers;
+                boarded_today += passengers;
+                if (recorder) recorder->sailed(t, i, q, passengers, length[q], balked[q]);
+            }
+        }
+        count(COUNT_BOARDED, boarded_today);
+    }
+
+    /*
+        Cumulative number of agents carried by each queue's ferries, e.g. tripsBoarded(QUEUE_CVG) is car trips to the coast
+    */
+    int64_t tripsBoarded(FerryQueue q) const {
+        return boarded[q];
+    }
+    int64_t queueLength(FerryQueue q) const {
+        return length[q];
+    }
+    int64_t tripsBalked(FerryQueue q) const {
+        return balked[q];
+    }
+    /*
+        Agents at destination who do not live there, including the ones queueing to go home, by willingness to bike
+    */
+    int64_t visitors(Place destination, BikeType will_bike) const {
+        int64_t n = 0;
+        for (Place home : HOME_ORDER) {
+            if (home == destination) continue;
+            for (int64_t people : away[cell(home, destination, will_bike)]) n += people;
+        }
+        for (const std::deque<Group>& queue : queues) {
+            for (const Group& group : queue) {
+                for (const Batch& b : group.batches) {
+                    if (b.days == 0 && cellDestination(b.cell) == destination && cellBike(b.cell) == will_bike) n += b.count;
+                }
+            }
+        }
+        return n;
+    }
+
+private:
+    //cell index = home * 12 + destination * 3 + will_bike; cells with destination == home are never used
+    static const int CELLS_PER_HOME = 12;
+    static const int N_CELLS = 4 * CELLS_PER_HOME;
+    static constexpr Place HOME_ORDER[4] = {VANCOUVER, SECHELT, GIBSONS, ROBERTS_CREEK}; //the order buildBasePopulation (agents.h) adds agents in
+    static int cell(Place home, Place destination, BikeType will_bike) {
+        return home * CELLS_PER_HOME + destination * 3 + will_bike;
+    }
+    static Place cellDestination(int c) {
+        return static_cast<Place>((c % CELLS_PER_HOME) / 3);
+    }
+    static BikeType cellBike(int c) {
+        return static_cast<BikeType>(c % 3);
+    }
+
+    /*
+        A batch is count agents of one cell with the same days left; days is 0 for people going home.
+        A group is everything that joined one queue from one home on one day.
+    */
+    struct Batch {
+        int cell;
+        int days;
+        int64_t count;
+    };
+    struct Group {
+        std::vector<Batch> batches;
+        int64_t size = 0;
+        void add(int c, int days, int64_t count) {
+            if (count <= 0) return;
+            batches.push_back({c, days, count});
+            size += count;
+        }
+    };
+
+    static int64_t binomial(int64_t n, double p, RandomStream& rng) {
+        if (n <= 0 || p <= 0.0) return 0;
+        if (p >= 1.0) return n;
+        return std::binomial_distribution<int64_t>(n, p)(rng);
+    }
+    void arrive(const Batch& b, int64_t count) {
+        if (b.days > 0) away[b.cell][b.days] += count; //off on vacation
+        else at_home[b.cell] += count; //back home
+    }
+    /*
+        Everyone past the balk point stays out of the queue: new trips are called off, and people going home stay
+        away with no days left so they try again tomorrow (the shift for today has already happened)
+    */
+    void balk(FerryQueue q, Group& group) {
+        int64_t room = std::max<int64_t>(0, scenario.balk_length - length[q]);
+        if (group.size <= room) return;
+        int64_t draws = room;
+        int64_t total = group.size;
+        for (Batch& b : group.batches) {
+            int64_t k = sampleHypergeometric(total, b.count, draws, queue_randomizers[q]);
+            total -= b.count;
+            draws -= k;
+            if (b.days > 0) at_home[b.cell] += b.count - k;
+            else away[b.cell][0] += b.count - k;
+            b.count = k;
+        }
+        balked[q] += group.size - room;
+        group.size = room;
+    }
+    int64_t boardFerry(FerryQueue q, int capacity) {
+        int64_t passengers = 0;
+        std::deque<Group>& queue = queues[q];
+        while (capacity > 0 && !queue.empty()) {
+            Group& front = queue.front();
+            if (front.size <= capacity) {
+                for (const Batch& b : front.batches) arrive(b, b.count);
+                capacity -= front.size;
+                passengers += front.size;
+                queue.pop_front();
+                continue;
+            }
+            //only part of the group fits
+            int64_t draws = capacity;
+            int64_t total = front.size;
+            for (Batch& b : front.batches) {
+                int64_t k = sampleHypergeometric(total, b.count, draws, queue_randomizers[q]);
+                total -= b.count;
+                draws -= k;
+                b.count -= k;
+                arrive(b, k);
+            }
+            front.size -= capacity;
+            passengers += capacity;
+            capacity = 0;
+        }
+        length[q] -= passengers;
+        return passengers;
+    }
+
+    Scenario scenario;
+    RandomStream randomizer;
+    std::vector<RandomStream> queue_randomizers; //today's, see step
+    int64_t at_home[N_CELLS];
+    int64_t away[N_CELLS][Population::MAX_TRIP_DAYS + 1]; //not queued, indexed by vacation days left
+    std::deque<Group> queues[N_QUEUES];
+    int64_t length[N_QUEUES]; //agents in each queue, the sum of the group sizes
+    int64_t boarded[N_QUEUES];
+    int64_t balked[N_QUEUES];
+    double p_zero_length;
+    double conditional[Population::MAX_TRIP_DAYS + 1];
+};
+
+#endif // COHORT_H
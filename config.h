@@ -0,0 +1,235 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "model.h"
+/*
+    Batch configuration. Instead of answering the questions in main() for every run, a batch describes a grid of
+    scenarios, either in a file (--config sweep.txt) or on the command line (--bike_path n,r,s). Options given on the
+    command line override the ones in the file. A file has one option per line and # starts a comment:
+
+        engine = e                  # a, c or e, as in the interactive question, or n for a route network
+        network = ferries.txt       # optional, engine n only: the places and routes (network.h), built in if not given
+        iterations = 20             # the most iterations when there is a precision target
+        precision = 0.01            # optional, stop a scenario once its 95% intervals are within 1% of the mean
+        time_budget = 600           # optional, seconds; stop adding iterations after this long
+        bike_path = n, r, s
+        p_bike_if_lane = 0:0.5:0.05 # start:stop:step, both ends included
+        p_always_bike = 0.01
+        ferries_per_day = 4, 6
+        cars_per_ferry = 115
+        bikes_per_ferry = 370
+        balk_length = 0             # 0 means nobody balks
+        output = sweep.csv          # or none, to only write the sailing records
+        summary = summary.csv       # optional, mean, spread and quantiles of every day over the iterations
+        records = sailings.bin      # optional, every sailing of every queue (see records.h)
+        fork_day = 151              # optional, agent engine only: share the days before this one, see below
+        snapshots = warmups         # optional, a directory to keep the shared days in (see snapshot.h)
+        population_cache = agents   # optional, a directory to keep the agents of each iteration in (population_cache.h)
+        baseline = n                # optional, compare every scenario with the one with this bike path, see below
+        differences = deltas.csv    # optional, the comparisons with the baseline for every day
+        antithetic = on             # optional, run the iterations in antithetic pairs (needs an even number of them)
+        common_random_numbers = on  # the default; off gives every scenario independent random numbers
+
+    Every option that takes a list can also take a single value. The scenarios are all combinations of the lists,
+    in the order above with bike_path varying slowest. On a route network a bike path can be any lowercase letter the
+    network file uses for its bike lanes; the other engines only know n, r and s.
+    The iterations run in rounds (see main), and the output table is written in blocks of STATS_ROUND iterations, so it
+    comes block by block rather than scenario by scenario. With a precision target every scenario gets iterations until the 95%
+    confidence intervals of its car and its bike trips for the year are within that fraction of their means, up to the
+    number of iterations given; the summary (statistics.h) says how many each scenario got.
+    With fork_day = F > 0 the scenarios that have the same p_bike_if_lane and p_always_bike (and so the same agents)
+    do not each simulate days 0 .. F - 1: those days are simulated once per iteration with the first of them, and every
+    scenario carries on from that state with its own bike path, ferries and balk point. In other words the scenarios
+    only differ from day F on; F = PEAK_SEASON_START compares policies for the peak season at about half the cost. The
+    sailing records of a forked run start on day F. With snapshots = DIR the shared states are also saved in DIR, and
+    a later run with the same seed and settings loads them instead of simulating those days again.
+    With a baseline every scenario is compared, iteration by iteration, with the scenario that has the same parameters
+    and the baseline bike path. Since the scenarios of an iteration share their random numbers, the differences are
+    much less noisy than the scenarios themselves. A precision target then applies to the differences instead: a
+    baseline and the scenarios compared with it get iterations until the intervals of the differences of the trips for
+    the year are within that fraction of the baseline's trips.
+*/
+struct BatchConfig {
+    bool enabled = false; //false means the interactive questions are asked instead
+    char engine = 'e';
+    int n_iterations = 1;
+    double precision = 0.0; //0 means every scenario gets n_iterations
+    double time_budget = 0.0; //seconds, 0 means no limit
+    std::string summary; //empty means no summary file
+    std::string output = "sweep.csv";
+    std::string records; //empty means no sailing records
+    int fork_day = 0; //0 means every scenario is simulated from day 0
+    std::string snapshots; //empty means the shared days are not saved
+    std::string population_cache; //empty means the agents are built for every scenario
+    std::string network; //empty means the built-in one, engine n only
+    char baseline = 0; //0 means no comparisons
+    std::string differences; //empty means no differences file
+    bool antithetic = false;
+    bool common_random_numbers = true;
+    std::vector<char> bike_paths = {'n', 'r', 's'};
+    std::vector<double> p_bike_if_lane = {0.0};
+    std::vector<double> p_always_bike = {Scenario().p_always_bike};
+    std::vector<double> ferries_per_day = {FERRIES_PER_DAY};
+    std::vector<double> cars_per_ferry = {CARS_PER_FERRY};
+    std::vector<double> bikes_per_ferry = {BIKES_PER_FERRY};
+    std::vector<double> balk_length = {0};
+
+    std::vector<Scenario> scenarios() const {
+        std::vector<Scenario> grid;
+        for (char path : bike_paths)
+        for (double lane : p_bike_if_lane)
+        for (double always : p_always_bike)
+        for (double ferries : ferries_per_day)
+        for (double cars : cars_per_ferry)
+        for (double bikes : bikes_per_ferry)
+        for (double balk : balk_length) {
+            Scenario s;
+            s.bike_path = path;
+            s.p_bike_if_lane = (float) lane;
+            s.p_always_bike = (float) always;
+            s.ferries_per_day = (int) ferries;
+            s.cars_per_ferry = (int) cars;
+            s.bikes_per_ferry = (int) bikes;
+            s.balk_length = (int) balk;
+            grid.push_back(s);
+        }
+        return grid;
+    }
+};
+
+/*
+    "0.1, 0.2" or "0.1 0.2" is a list, "0:1:0.25" is the range 0, 0.25, 0.5, 0.75, 1
+*/
+inline std::vector<double> parseValues(const std::string& key, const std::string& text) {
+    std::string spaced = text;
+    for (char& c : spaced) if (c == ',') c = ' ';
+    std::istringstream in(spaced);
+    std::vector<double> values;
+    std::string item;
+    while (in >> item) {
+        double start, stop, step;
+        char colon1, colon2;
+        std::istringstream range(item);
+        if (item.find(':') != std::string::npos) {
+            if (!(range >> start >> colon1 >> stop >> colon2 >> step) || colon1 != ':' || colon2 != ':' || step <= 0.0) {
+                throw std::runtime_error("Bad range '" + item + "' for " + key + ", expected start:stop:step");
+            }
+            int n = (int) std::floor((stop - start) / step + 1e-9) + 1;
+            for (int i (0); i < n; ++i) values.push_back(start + i * step);
+        }
+        else {
+            double value;
+            if (!(range >> value) || !range.eof()) throw std::runtime_error("Bad value '" + item + "' for " + key);
+            values.push_back(value);
+        }
+    }
+    if (values.empty()) throw std::runtime_error("No values given for " + key);
+    return values;
+}
+
+inline bool parseSwitch(const std::string& key, const std::string& value) {
+    if (value == "on") return true;
+    if (value == "off") return false;
+    throw std::runtime_error(key + " must be on or off");
+}
+
+inline void checkBetween(const std::string& key, const std::vector<double>& values, double low, double high) {
+    for (double v : values) {
+        if (v < low || v > high) throw std::runtime_error(key + " must be between " + std::to_string(low) + " and " + std::to_string(high));
+    }
+}
+
+/*
+    Set one option. Dashes and underscores are interchangeable in the key, so --bike-path works too.
+    Returns false if the key is not a batch option.
+*/
+inline bool setBatchOption(BatchConfig& config, std::string key, const std::string& value) {
+    for (char& c : key) if (c == '-') c = '_';
+    if (key == "engine") {
+        if (value != "a" && value != "c" && value != "e" && value != "n") throw std::runtime_error("engine must be a, c, e or n");
+        config.engine = value[0];
+    }
+    else if (key == "iterations") {
+        std::vector<double> v = parseValues(key, value);
+        checkBetween(key, v, 1, 1e9);
+        config.n_iterations = (int) v[0];
+    }
+    else if (key == "output") config.output = value;
+    else if (key == "summary") config.summary = value;
+    else if (key == "precision") {
+        std::vector<double> v = parseValues(key, value);
+        checkBetween(key, v, 0.0, 1e9);
+        config.precision = v[0];
+    }
+    else if (key == "time_budget") {
+        std::vector<double> v = parseValues(key, value);
+        checkBetween(key, v, 0.0, 1e12);
+        config.time_budget = v[0];
+    }
+    else if (key == "records") config.records = value;
+    else if (key == "fork_day") {
+        std::vector<double> v = parseValues(key, value);
+        checkBetween(key, v, 0, 365);
+        config.fork_day = (int) v[0];
+    }
+    else if (key == "snapshots") config.snapshots = value;
+    else if (key == "population_cache") config.population_cache = value;
+    else if (key == "network") config.network = value;
+    else if (key == "baseline") {
+        if (value.size() != 1 || value[0] < 'a' || value[0] > 'z') throw std::runtime_error("baseline must be a bike path, like n, r or s");
+        config.baseline = value[0];
+    }
+    else if (key == "differences") config.differences = value;
+    else if (key == "antithetic") config.antithetic = parseSwitch(key, value);
+    else if (key == "common_random_numbers") config.common_random_numbers = parseSwitch(key, value);
+    else if (key == "bike_path") {
+        config.bike_paths.clear();
+        for (char c : value) {
+            if (c >= 'a' && c <= 'z') config.bike_paths.push_back(c);
+            else if (c != ',' && c != ' ' && c != '\t') throw std::runtime_error("bike_path values must be letters, like n, r or s");
+        }
+        if (config.bike_paths.empty()) throw std::runtime_error("No values given for bike_path");
+    }
+    else if (key == "p_bike_if_lane") checkBetween(key, config.p_bike_if_lane = parseValues(key, value), 0.0, 1.0);
+    else if (key == "p_always_bike") checkBetween(key, config.p_always_bike = parseValues(key, value), 0.0, 1.0);
+    else if (key == "ferries_per_day") checkBetween(key, config.ferries_per_day = parseValues(key, value), 0, MAX_FERRIES_PER_DAY);
+    else if (key == "cars_per_ferry") checkBetween(key, config.cars_per_ferry = parseValues(key, value), 0, 1e9);
+    else if (key == "bikes_per_ferry") checkBetween(key, config.bikes_per_ferry = parseValues(key, value), 0, 1e9);
+    else if (key == "balk_length") checkBetween(key, config.balk_length = parseValues(key, value), 0, 1e9);
+    else return false;
+    config.enabled = true;
+    return true;
+}
+
+inline void readBatchFile(BatchConfig& config, const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Could not open the configuration file " + path);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        std::size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::size_t equals = line.find('=');
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue; //blank line
+        if (equals == std::string::npos) throw std::runtime_error(path + ":" + std::to_string(line_number) + ": expected key = value");
+        auto trim = [](std::string s) {
+            std::size_t first = s.find_first_not_of(" \t\r");
+            std::size_t last = s.find_last_not_of(" \t\r");
+            return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+        };
+        std::string key = trim(line.substr(0, equals));
+        if (!setBatchOption(config, key, trim(line.substr(equals + 1)))) {
+            throw std::runtime_error(path + ":" + std::to_string(line_number) + ": unknown option " + key);
+        }
+    }
+    config.enabled = true;
+}
+
+#endif // CONFIG_H
@@ -0,0 +1,199 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "population.h"
+#include "model.h"
+#include "ferry_queue.h"
+#include "records.h"
+#include "instrument.h"
+/*
+    __EVENT-DRIVEN ENGINE__
+    The per-day chance of starting a trip is only about 0.001 to 0.007, so the agent-based loop spends almost all of its
+    time drawing "no trip today" for agents at home and counting down the vacation days of agents who are away. Here
+    each agent is only touched when something happens to them:
+    - For an agent at home we draw the day of their next trip directly. The number of quiet days before a trip is
+      geometric, so we skip ahead a whole season at a time (the rate changes between seasons, and since the
+      geometric distribution is memoryless we just draw again from the start of the next season).
+    - For an agent who gets off the ferry at their destination we already know the return day, so it goes in the
+      calendar too. This is the calendar system for return trips from note 3.
+    The calendar has one bucket of agent indices per day. Each day we take that day's bucket, sort it so the agents
+    join the queues in the same order as in the agent-based loop, and push them into the ferry queues.
+    Boarding is the same as in the agent-based loop. The rules are the same, so the results are the same in
+    distribution; only the random draws differ.
+    Every draw comes from a substream of its own: the next trip of agent k searching from day d from
+    (STREAM_TRIP_STARTS, k, d), the length of the trip k starts on day t from (STREAM_TRIP_LENGTHS, k, t). Scenarios
+    that run with the same stream then give an agent the same trips for as long as their days go the same way, instead
+    of everything shifting after the first agent whose day went differently (common random numbers, see runScenarios).
+*/
+
+class Calendar {
+public:
+    explicit Calendar(int horizon) : days(horizon) {}
+    int horizon() const {
+        return (int) days.size();
+    }
+    /*
+        Anything scheduled past the end of the run is dropped, it would never happen anyway
+    */
+    void schedule(int day, uint32_t agent) {
+        if (day < horizon()) days[day].push_back(agent);
+    }
+    std::vector<uint32_t>& bucket(int day) {
+        return days[day];
+    }
+private:
+    std::vector<std::vector<uint32_t>> days;
+};
+
+/*
+    First day on or after day on which agent k, at home, starts a trip, or horizon if they don't start one. p_peak and
+    p_nonpeak are the chances per day of a trip of at least one day in and out of the peak season.
+*/
+inline int nextTripStart(const RandomStream& randomizer, uint32_t k, int day, int horizon, double p_peak, double p_nonpeak) {
+    RandomStream start_randomizer = randomizer.substream(STREAM_TRIP_STARTS, k, day);
+    while (day < horizon) {
+        bool peak = isPeakSeason(day);
+        int season_end = peak ? PEAK_SEASON_END + 1 : (day < PEAK_SEASON_START ? PEAK_SEASON_START : horizon);
+        double p = peak ? p_peak : p_nonpeak;
+        if (p > 0.0) {
+            int quiet_days = std::geometric_distribution<int>(p)(start_randomizer);
+            if (quiet_days < season_end - day) return day + quiet_days;
+        }
+        day = season_end;
+    }
+    return horizon;
+}
+
+class EventModel {
+public:
+    EventModel(const Population& population, const Scenario& parameters, int t_max, const RandomStream& rng)
+        : world(population), scenario(parameters), calendar(t_max), randomizer(rng), trip_length(n_days) {
+        for (int q (0); q < N_QUEUES; ++q) {
+            boarded[q] = 0;
+            balked[q] = 0;
+        }
+        //chance per day of a trip of at least one day, see getTripLengths in agents.h
+        double p_nonzero = 1.0 - std::exp(-trip_length.mean());
+        p_start_peak = takes_trip_peak.p() * p_nonzero;
+        p_start_nonpeak = takes_trip_nonpeak.p() * p_nonzero;
+        for (std::size_t i (0); i < world.size(); ++i) {
+            calendar.schedule(nextTripStart((uint32_t) i, 0), (uint32_t) i);
+        }
+    }
+
+    /*
+        One day; with a recorder every sailing is also recorded (see records.h)
+    */
+    void step(int t, SailingRecorder* recorder = nullptr) {
+        {
+            ScopedTimer timer(PHASE_ROUTING); //the trip lengths are drawn in here too, one agent at a time
+            const RoutingTable& routing = routingTable(scenario.bike_path);
+            std::vector<uint32_t>& today = calendar.bucket(t);
+            std::sort(today.begin(), today.end()); //index order, like the agent-based loop
+            int64_t returns = 0, balked_today = 0;
+            for (uint32_t k : today) {
+                Place home = world.getHome(k);
+                Place location = world.getLocation(k);
+                bool returning = (location != home);
+                if (!returning) {
+                    RandomStream length_randomizer = randomizer.substream(STREAM_TRIP_LENGTHS, k, t);
+                    int days;
+                    do days = trip_length(length_randomizer); while (days == 0); //we already know the trip is at least one day long
+                    world.setTripDays(k, days);
+                }
+                returns += returning;
+                FerryQueue q = (FerryQueue) routing.queue[world.placeData()[k]];
+                if (balks(ferry_queues[q].size(), scenario)) {
+                    world.balk(k);
+                    ++balked[q];
+                    ++balked_today;
+                    calendar.schedule(returning ? t + 1 : nextTripStart(k, t + 1), k);
+                    continue;
+                }
+                ferry_queues[q].push_back(k);
+                world.setQueued(k);
+            }
+            count(COUNT_TRIPS_STARTED, (int64_t) today.size() - returns);
+            count(COUNT_RETURNS, returns);
+            count(COUNT_BALKS, balked_today);
+            for (int q (0); q < N_QUEUES; ++q) recordQueueLength((FerryQueue) q, (int64_t) ferry_queues[q].size());
+            std::vector<uint32_t>().swap(today); //done with this day, free the memory
+        }
+        ScopedTimer timer(PHASE_BOARDING);
+        int64_t boarded_today = 0;
+        for (int i (0); i < scenario.ferries_per_day; ++i) {
+            for (FerryQueue q : BOARDING_ORDER) {
+                int passengers = boardFerry(q, ferryCapacity(q, scenario), t);
+                boarded[q] += passengers;
+                boarded_today += passengers;
+                if (recorder) recorder->sailed(t, i, q, passengers, (int64_t) ferry_queues[q].size(), balked[q]);
+            }
+        }
+        count(COUNT_BOARDED, boarded_today);
+    }
+
+    /*
+        Cumulative number of agents carried by each queue's ferries, e.g. tripsBoarded(QUEUE_CVG) is car trips to the coast
+    */
+    int64_t tripsBoarded(FerryQueue q) const {
+        return boarded[q];
+    }
+    int64_t queueLength(FerryQueue q) const {
+        return (int64_t) ferry_queues[q].size();
+    }
+    int64_t tripsBalked(FerryQueue q) const {
+        return balked[q];
+    }
+    /*
+        As in the cohort engine (cohort.h); a pass over every agent, so for checks rather than every day of a run
+    */
+    int64_t visitors(Place destination, BikeType will_bike) const {
+        int64_t n = 0;
+        for (std::size_t i (0); i < world.size(); ++i) {
+            n += world.getLocation(i) == destination && world.getHome(i) != destination && world.willBike(i) == will_bike;
+        }
+        return n;
+    }
+
+private:
+    int nextTripStart(uint32_t k, int day) const {
+        return ::nextTripStart(randomizer, k, day, calendar.horizon(), p_start_peak, p_start_nonpeak);
+    }
+    /*
+        Like boardFerry in agents.h, but also puts each passenger's next event in the calendar. Someone who gets
+        off at their destination on day t counts down their trip on days t + 1 to t + days and joins the return
+        queue the day after; someone who gets home can start their next trip tomorrow.
+    */
+    int boardFerry(FerryQueue q, int capacity, int t) {
+        return (int) ferry_queues[q].popFront(capacity, [&](const uint32_t* agents, std::size_t n) {
+            for (std::size_t m (0); m < n; ++m) {
+                uint32_t k = agents[m];
+                int days = world.getTripDays(k);
+                world.board(k);
+                if (world.isOnVacation(k)) {
+                    calendar.schedule(t + days + 1, k);
+                    world.setTripDays(k, 0); //the calendar keeps track of the return now
+                }
+                else calendar.schedule(nextTripStart(k, t + 1), k);
+            }
+        });
+    }
+
+    Population world;
+    Scenario scenario;
+    Calendar calendar;
+    RandomStream randomizer;
+    std::poisson_distribution<> trip_length;
+    PassengerQueue ferry_queues[N_QUEUES];
+    int64_t boarded[N_QUEUES];
+    int64_t balked[N_QUEUES];
+    double p_start_peak;
+    double p_start_nonpeak;
+};
+
+#endif // EVENTS_H
@@ -0,0 +1,80 @@
+#ifndef FERRY_QUEUE_H
+#define FERRY_QUEUE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+/*
+    A ferry queue of agent indices, kept in a ring buffer. The buffer has a fixed capacity (a power of two, so wrapping
+    around is a mask instead of a division) and only doubles if it ever fills up, which in practice happens a handful of
+    times at the start of the peak season. Boarding takes the front of the queue as at most two contiguous spans, one
+    up to the end of the buffer and one from the start, so the boarding loop runs over plain arrays and dropping the
+    boarded agents is just moving the head.
+*/
+class PassengerQueue {
+public:
+    explicit PassengerQueue(std::size_t initial_capacity = 1024) {
+        std::size_t capacity = 1;
+        while (capacity < initial_capacity) capacity *= 2;
+        buffer.resize(capacity);
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+    bool empty() const {
+        return count == 0;
+    }
+    uint32_t operator[](std::size_t i) const {
+        return buffer[(head + i) & mask()];
+    }
+    void push_back(uint32_t agent) {
+        if (count == buffer.size()) grow(count + 1);
+        buffer[(head + count) & mask()] = agent;
+        ++count;
+    }
+    void append(const uint32_t* agents, std::size_t n) {
+        if (n == 0) return; //agents can be the null data() of an empty vector, and memcpy must not get a null pointer
+        if (count + n > buffer.size()) grow(count + n);
+        std::size_t tail = (head + count) & mask();
+        std::size_t first = std::min(n, buffer.size() - tail);
+        std::memcpy(&buffer[tail], agents, first * sizeof(uint32_t));
+        std::memcpy(&buffer[0], agents + first, (n - first) * sizeof(uint32_t));
+        count += n;
+    }
+    /*
+        Remove up to n agents from the front of the queue. board(span, length) is called once or twice with the removed
+        agents in queue order. Returns how many were removed.
+    */
+    template <class Board>
+    std::size_t popFront(std::size_t n, Board board) {
+        if (n > count) n = count;
+        std::size_t first = std::min(n, buffer.size() - head);
+        if (first > 0) board(&buffer[head], first);
+        if (n > first) board(&buffer[0], n - first);
+        head = (head + n) & mask();
+        count -= n;
+        return n;
+    }
+
+private:
+    std::size_t mask() const {
+        return buffer.size() - 1;
+    }
+    void grow(std::size_t needed) {
+        std::size_t capacity = buffer.size();
+        while (capacity < needed) capacity *= 2;
+        std::vector<uint32_t> bigger (capacity);
+        for (std::size_t i (0); i < count; ++i) bigger[i] = (*this)[i];
+        buffer.swap(bigger);
+        head = 0;
+    }
+
+    std::vector<uint32_t> buffer;
+    std::size_t head = 0;
+    std::size_t count = 0;
+};
+
+#endif // FERRY_QUEUE_H
@@ -0,0 +1,188 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include "model.h"
+/*
+    __INSTRUMENTATION__
+    Where does the time go? The engines wrap each phase of a day in a ScopedTimer and count what happens with count().
+    Both write to plain per-thread totals, so there are no atomics or locks on the hot paths; a thread adds its totals
+    to the global ones when it exits (the sweep workers of an AgentModel when the model is destroyed, see ThreadPool in
+    parallel.h) and --stats FILE writes the sum at the end of the run, as JSON if FILE ends in .json and as CSV
+    otherwise.
+    Phase times are summed over threads, so with several threads they add up to more than the wall time.
+*/
+
+enum Phase {
+    PHASE_TRIP_SAMPLING = 0, //who starts a trip today and for how long
+    PHASE_DESTINATIONS, //where Vancouverites go, while building the base population
+    PHASE_ROUTING, //joining the ferry queues, including balking
+    PHASE_BOARDING,
+    PHASE_OUTPUT, //writing the daily table and the sailing records
+    N_PHASES
+};
+const char* const PHASE_NAMES[N_PHASES] = {"trip_sampling", "destinations", "routing", "boarding", "output"};
+
+enum Counter {
+    COUNT_TRIPS_STARTED = 0,
+    COUNT_RETURNS, //agents who joined a queue to go home
+    COUNT_BOARDED,
+    COUNT_BALKS,
+    N_COUNTERS
+};
+const char* const COUNTER_NAMES[N_COUNTERS] = {"trips_started", "returns", "boarded", "balks"};
+const char* const QUEUE_NAMES[N_QUEUES] = {"car_to_coast", "bike_to_coast", "car_to_vancouver", "bike_to_vancouver"}; //by FerryQueue
+
+struct Stats {
+    int64_t phase_ns[N_PHASES] = {};
+    int64_t phase_calls[N_PHASES] = {};
+    int64_t counts[N_COUNTERS] = {};
+    int64_t queue_high_water[N_QUEUES] = {}; //longest each queue has been after the agents of a day joined it
+
+    void add(const Stats& other) {
+        for (int p (0); p < N_PHASES; ++p) {
+            phase_ns[p] += other.phase_ns[p];
+            phase_calls[p] += other.phase_calls[p];
+        }
+        for (int c (0); c < N_COUNTERS; ++c) counts[c] += other.counts[c];
+        for (int q (0); q < N_QUEUES; ++q) queue_high_water[q] = std::max(queue_high_water[q], other.queue_high_water[q]);
+    }
+};
+
+/*
+    The totals of the threads that have finished, and the lock that guards them
+*/
+inline Stats& finishedStats() {
+    static Stats totals;
+    return totals;
+}
+inline std::mutex& finishedStatsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+struct ThreadStats {
+    Stats stats;
+    void flush() {
+        std::lock_guard<std::mutex> lock(finishedStatsMutex());
+        finishedStats().add(stats);
+        stats = Stats();
+    }
+    ~ThreadStats() {
+        flush();
+    }
+};
+inline Stats& threadStats() {
+    thread_local ThreadStats mine;
+    return mine.stats;
+}
+
+inline void count(Counter counter, int64_t n = 1) {
+    threadStats().counts[counter] += n;
+}
+inline void recordQueueLength(FerryQueue q, int64_t length) {
+    int64_t& high = threadStats().queue_high_water[q];
+    if (length > high) high = length;
+}
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Phase timed_phase) : phase(timed_phase), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        Stats& stats = threadStats();
+        stats.phase_ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        ++stats.phase_calls[phase];
+    }
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+/*
+    Everything so far. Only call this when no other thread is still running the model.
+*/
+inline Stats collectStats() {
+    std::lock_guard<std::mutex> lock(finishedStatsMutex());
+    Stats totals = finishedStats();
+    totals.add(threadStats());
+    return totals;
+}
+
+inline void writeStats(const std::string& path, double wall_seconds) {
+    Stats stats = collectStats();
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Could not open the statistics file " + path);
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+        out << "{\n  \"wall_seconds\": " << wall_seconds << ",\n  \"phases\": {\n";
+        for (int p (0); p < N_PHASES; ++p) {
+            out << "    \"" << PHASE_NAMES[p] << "\": {\"seconds\": " << stats.phase_ns[p] * 1e-9 << ", \"calls\": "
+                << stats.phase_calls[p] << "}" << (p + 1 < N_PHASES ? "," : "") << "\n";
+        }
+        out << "  },\n  \"counters\": {\n";
+        for (int c (0); c < N_COUNTERS; ++c) {
+            out << "    \"" << COUNTER_NAMES[c] << "\": " << stats.counts[c] << (c + 1 < N_COUNTERS ? "," : "") << "\n";
+        }
+        out << "  },\n  \"queue_high_water\": {\n";
+        for (int q (0); q < N_QUEUES; ++q) {
+            out << "    \"" << QUEUE_NAMES[q] << "\": " << stats.queue_high_water[q] << (q + 1 < N_QUEUES ? "," : "") << "\n";
+        }
+        out << "  }\n}\n";
+    }
+    else {
+        out << "Kind,Name,Value\n";
+        out << "wall_seconds,total," << wall_seconds << "\n";
+        for (int p (0); p < N_PHASES; ++p) out << "phase_seconds," << PHASE_NAMES[p] << "," << stats.phase_ns[p] * 1e-9 << "\n";
+        for (int p (0); p < N_PHASES; ++p) out << "phase_calls," << PHASE_NAMES[p] << "," << stats.phase_calls[p] << "\n";
+        for (int c (0); c < N_COUNTERS; ++c) out << "counter," << COUNTER_NAMES[c] << "," << stats.counts[c] << "\n";
+        for (int q (0); q < N_QUEUES; ++q) out << "queue_high_water," << QUEUE_NAMES[q] << "," << stats.queue_high_water[q] << "\n";
+    }
+    if (!out) throw std::runtime_error("Writing the statistics file " + path + " failed");
+}
+
+/*
+    Replaces the old "This is day t of iteration n" line: the engines call advance() after every simulated day, from
+    any thread, and at most every interval seconds one line goes to standard output saying how far the run has got.
+*/
+class ProgressReporter {
+public:
+    explicit ProgressReporter(int64_t total_days, double interval_seconds = 2.0)
+        : total(total_days), interval(interval_seconds), start(std::chrono::steady_clock::now()), next_report(interval_seconds) {}
+
+    void advance(int64_t days = 1) {
+        int64_t done = finished += days;
+        double elapsed = secondsSinceStart();
+        if (elapsed < next_report.load(std::memory_order_relaxed)) return;
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (!lock || elapsed < next_report) return; //somebody else is reporting
+        next_report = elapsed + interval;
+        double left = elapsed * (total - done) / std::max<int64_t>(done, 1);
+        std::cout << "Simulated " + std::to_string(done) + " of " + std::to_string(total) + " days ("
+            + std::to_string(100 * done / std::max<int64_t>(total, 1)) + "%), " + std::to_string((int) elapsed) + " s so far, about "
+            + std::to_string((int) left + 1) + " s to go\n" << std::flush;
+    }
+    void finish() {
+        std::cout << "Simulated " << finished << " days in " << secondsSinceStart() << " s" << std::endl;
+    }
+    double secondsSinceStart() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    int64_t total;
+    double interval;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<int64_t> finished {0};
+    std::atomic<double> next_report;
+    std::mutex mutex;
+};
+
+#endif // INSTRUMENT_H
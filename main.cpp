@@ -1,10 +1,30 @@
 #include <vector>
-#include <deque>
 #include <iostream>
 #include <fstream>
 #include <random>
 #include <algorithm>
 #include <chrono> //for seeding PRNGs
+#include <array>
+#include <string>
+#include <cstdlib>
+#include "population.h"
+#include "model.h"
+#include "cohort.h"
+#include "events.h"
+#include "rng.h"
+#include "parallel.h"
+#include "config.h"
+#include "ferry_queue.h"
+#include "records.h"
+#include "agents.h"
+#include "instrument.h"
+#include "snapshot.h"
+#include "population_cache.h"
+#include "statistics.h"
+#include "network.h"
+#include "network_model.h"
+#include <memory>
+#include <mutex>
 /*
     __STRUCTURE OF THE ALGORITHM__
     1. Define four locations: Metro Vancouver (V), Gibsons (G), Roberts Creek (R), and Sechelt (S). These locations have the following spatial
@@ -16,7 +36,8 @@
     who decides to go also decides on the trip length. [note 3]
     To do so, they join the ferry queue. [note 4]
     The ferry sails <number of times> per day and takes <number of agents> with it each time. Agents also have
-    a balk point, i.e. a point at which they do not take the ferry if the queue is too long.
+    a balk point, i.e. a point at which they do not take the ferry if the queue is too long. (Scenario::balk_length, checked when the
+    agent gets to the queue; someone leaving home calls the trip off, someone going home tries again the next day.)
     4. In each period, record the length of the ferry queue; and the number of passengers of each type
     __NOTES__
     [note 1] At this time, agents represent families but have no notion of size. Each agent represents MODEL_SCALE people, where
@@ -29,181 +50,606 @@
     [note 4] Really, there are two ferry queues: one for cyclists and one for motor vehicles
 */
 
-class Agent {
-public:
-    char home; //possible values 'v', 'g', 'r', 's' -- where does the agent live
-    char location; //possible values 'v', 'g', 'r', 's' -- where is the agent right now? this is more efficient than having a vector of agents
-    //for each location
-    char will_bike; //will an agent bike to their destination? 'n' (no) 'y' (yes) or 'p' (yes if there is a path)
-    /*
-        Constructor Functions
-    */
-    Agent(char h, char l, char w) { //construction with an argument
-        home = h;
-        location = l;
-        will_bike = w;
-    }
-    Agent() { //default constructor. We should basically never be using a default agent, this is just in case we need it
-        home = 'v'; //default agent lives in Vancouver
-        location = 'v'; //default agent is currently in their home of Vancouver
-        will_bike = 'n'; //arbitrarily chosen value (see above)
-    }
-    void setLocation(char new_location) {
-        location = new_location;
-    }
-    char getLocation() const{
-        return location;
-    }
-    char getHome() const{
-        return home;
-    }
-    void setBike(char new_willingness) {
-        will_bike = new_willingness;
-    }
-    char willBike() const{
-        return will_bike;
+/*
+    Days t_begin .. t_end - 1 of an agent-based model that has already simulated the days before t_begin
+*/
+void runAgentDays(AgentModel& agents, int t_begin, int t_end, int* car_trips, int* bike_trips, SailingRecorder* recorder,
+    ProgressReporter& progress) {
+    for (int t (t_begin); t < t_end; ++t) { //main loop for the days of the year
+        agents.step(t, recorder);
+        car_trips[t] = agents.tripsBoarded(QUEUE_CVG);
+        bike_trips[t] = agents.tripsBoarded(QUEUE_BVG);
+        progress.advance();
     }
-    bool isOnVacation() {
-        if (location == home) {
-            return false;
-        }
-        else return true;
+}
+/*
+    Run one iteration (one year) of the agent-based model (agents.h) for one scenario, starting from the agents of the
+    scenario (the base population after assignBikers), and store the cumulative trips of every day in car_trips[t] and
+    bike_trips[t]. With a recorder every sailing is recorded as well (records.h). Every day done is reported to progress
+    (instrument.h). Everything else the iteration needs is local, so iterations can run side by side on different threads.
+*/
+void runAgentIteration(const Scenario& scenario, Population british_columbia, int t_max, RandomStream& randomizer,
+    int n_threads, int* car_trips, int* bike_trips, SailingRecorder* recorder, ProgressReporter& progress) {
+    AgentModel agents(std::move(british_columbia), scenario, randomizer, n_threads);
+    runAgentDays(agents, 0, t_max, car_trips, bike_trips, recorder, progress);
+}
+/*
+    Same thing with the cohort engine (cohort.h)
+*/
+void runCohortIteration(const Scenario& scenario, int t_max, RandomStream& randomizer, int* car_trips, int* bike_trips,
+    SailingRecorder* recorder, ProgressReporter& progress) {
+    CohortModel cohorts(scenario, randomizer);
+    for (int t (0); t < t_max; ++t) {
+        cohorts.step(t, recorder);
+        car_trips[t] = cohorts.tripsBoarded(QUEUE_CVG);
+        bike_trips[t] = cohorts.tripsBoarded(QUEUE_BVG);
+        progress.advance();
     }
-    Agent& operator= (const Agent& other) {
-        home = getHome();
-        location = getLocation();
-        will_bike = willBike();
-        return *this;
+}
+/*
+    And with the event-driven engine (events.h), which only touches agents on the days they leave or come back
+*/
+void runEventIteration(const Scenario& scenario, const Population& british_columbia, int t_max, RandomStream& randomizer,
+    int* car_trips, int* bike_trips, SailingRecorder* recorder, ProgressReporter& progress) {
+    EventModel events(british_columbia, scenario, t_max, randomizer);
+    for (int t (0); t < t_max; ++t) {
+        events.step(t, recorder);
+        car_trips[t] = events.tripsBoarded(QUEUE_CVG);
+        bike_trips[t] = events.tripsBoarded(QUEUE_BVG);
+        progress.advance();
     }
-};
-
+}
 /*
-    Global constants
+    And on a route network (network_model.h), with the trips of the network's first ferry route. The agents are drawn
+    from agent_randomizer, the days from randomizer.
 */
-const float MODEL_SCALE (2.7); //the number of people per agent in the model
-const int CARS_PER_FERRY (311 / MODEL_SCALE); //how many cars each ferry takes
-const int BIKES_PER_FERRY (1000 / MODEL_SCALE); //how many bikes each ferry takes, these numbers are currently just placeholders
-const int FERRIES_PER_DAY (4);
-const double POPULATION_VANCOUVER (2.64e6); //scientific notation, 2.64e6 = 2.64*10^6 = 2.64 million
-const double POPULATION_SECHELT (1.0e4); //i want the extra precision of a double for these big numbers.
-const double POPULATION_GIBSONS (5.0e3);
-const double POPULATION_ROBERTSCREEK (3.0e3);
-const double TOTAL_POPULATION = POPULATION_SECHELT + POPULATION_GIBSONS + POPULATION_ROBERTSCREEK;
-char bike_path ('u'); //4 values: u for unset, n for "none," r for "only to robert's creek," and s for "all the way to sechelt"
+void runNetworkIteration(const Scenario& scenario, NetworkRoutes& network, int t_max, const RandomStream& agent_randomizer,
+    RandomStream& randomizer, int* car_trips, int* bike_trips, SailingRecorder* recorder, ProgressReporter& progress) {
+    NetworkModel model(network, scenario, t_max, agent_randomizer, randomizer);
+    for (int t (0); t < t_max; ++t) {
+        model.step(t, recorder);
+        car_trips[t] = model.tripsBoarded(QUEUE_CVG);
+        bike_trips[t] = model.tripsBoarded(QUEUE_BVG);
+        progress.advance();
+    }
+}
 
 /*
-    Randomness setup
-    Where do the magic numbers come from? The total estimated spend by tourists is 250*10^6 CA$. The average person
-    spends $245 per trip. I assume (totally arbitrary) that 2/3 of the money is spent in the peak season (in other words that
-    on average twice as many people visit during the peak season compared to the rest of the year). That just seemed
-    reasonable, I couldn't get any reliable information on whether that is true or not. That yields a split of $83*10^6 in the off
-    season and $166*10^6 in the peak season. Dividing that by the average spend per person yields 3.4 * 10^5 people in
-    the non-peak season and 6.8*10^5 people in the peak season. The peak season is 90 days, so 7555 people/day on average,
-    and for the non-peak season 1259 people/day. Note that these numbers are really the average number of trips that begin every day,
-    not the total number of tourists there at a time. There are about 3*10^6 people in Vancouver, using that as the denominator yields
-    that during the peak season the individual propensity to take a trip (takes_trip_peak) is 0.0025; during the off season that number
-    is 0.00042 (takes_trip_nonpeak). We then multiply by the model scale to make sure we are working with agents rather than
-    people.
+    Run n_iterations of every scenario and store the results of scenario s, iteration n in the block of t_max entries
+    starting at output[(s * n_iterations + n) * t_max].
+    The tasks are all (iteration, scenario) pairs, iteration by iteration, spread over a pool of threads. The base
+    population of an iteration is built by whichever task needs it first and thrown away when the last scenario of that
+    iteration is done, so there are never more than a few of them in memory. Iteration n draws all of its random numbers
+    from iterationStream(n) in every scenario, so it does not matter which thread runs it or when.
+    The output vectors can be left empty when only the sailing records are wanted.
+    While it runs a line of progress goes to standard output every few seconds. The rest is in RunOptions.
 */
-auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-std::mt19937 randomizer;
-std::poisson_distribution<> n_days(3.3); //the average trip length is 3.3 nights
-std::bernoulli_distribution takes_trip_peak(0.0025 * MODEL_SCALE); //chance per day the agent wants to take a trip to the sunshine coast
-std::bernoulli_distribution takes_trip_nonpeak(0.00042 * MODEL_SCALE); //see above for explanation of magic numbers
+struct RunOptions {
+    /*
+        Run iterations first_iteration .. first_iteration + n_iterations - 1, so a batch can be run in rounds (see
+        main). The output is still indexed from 0.
+    */
+    int first_iteration = 0;
+    std::vector<int> scenario_ids; //what the records and snapshots call each scenario, 0, 1, ... if empty
+    /*
+        All the scenarios of the batch, indexed by scenario id, when the scenarios run are only some of them. The
+        fork_day groups are led by the first scenario of the grid with the same agents, whether or not it still runs.
+    */
+    const std::vector<Scenario>* grid = nullptr;
+    RecordWriter* records = nullptr; //null when there are no sailing records
+    /*
+        With fork_day > 0 (agent engine only) the scenarios with the same agents share days 0 .. fork_day - 1, see
+        config.h. The shared state of an iteration is made the same way as the base population, by the first task that
+        needs it, and every scenario of the group continues from a copy of it. With a snapshot_dir the shared states are
+        saved there and reused by later runs (snapshot.h).
+    */
+    int fork_day = 0;
+    std::string snapshot_dir;
+    /*
+        With a population_cache the agents of every iteration and set of biker proportions are saved in that directory,
+        and loaded from there when they are already in it (population_cache.h)
+    */
+    std::string population_cache;
+    /*
+        Common random numbers: every scenario of an iteration draws from the same stream, and since the engines key
+        every draw to an agent (or a cell) and a day, an agent makes the same choices in every scenario for as long as
+        the scenarios do not change their days. The difference between two scenarios then has much less noise than
+        either of them (see statistics.h). Off gives the days of every scenario a stream of their own; the agents are
+        still the same (except with the cohort engine, which draws its agents as counts when it starts).
+        With antithetic pairs, iteration 2m + 1 is the antithetic twin of iteration 2m (see rng.h).
+    */
+    bool common_random_numbers = true;
+    bool antithetic = false;
+    NetworkRoutes* network = nullptr; //for engine n, shared by the rounds of a batch; the built-in network if null
+};
 /*
-    Helper function that will enable us to pair an Agent with an integer representing how long their vacation is
-    without adding an attribute to agents or working with a computationally costly vector<Agent>.
-    getTripLengths takes three arguments: First, world is a vector of all the Agents in the model. Second, trip_lengths is
-    a vector<int> that stores the lengths of the vacations agents are taking. Because one cannot take a vacation of
-    length 0, that corresponds to not being on vacation. Third, there is a boolean indicating whether it is the
-    peak season or not, as that affects the chances of taking a trip.
+    The random numbers of iteration n, for the master seed
 */
-void getTripLengths(std::vector<Agent>& world, std::vector<int>& trip_lengths, bool is_peak) {
-    if (world.size() != trip_lengths.size()) {
-        throw std::runtime_error("The vectors world and trip_lengths must have the same size");
-    } //make sure we don't do anything funky with differently sized vectors.
-    for (int i (0); i < world.size(); ++i) {
-        if (is_peak && !world[i].isOnVacation()) { //if they're already on vacation they're not going to take another trip
-            trip_lengths[i] = takes_trip_peak(randomizer) * n_days(randomizer); //because takes_trip_peak is 0 if they decide not to take a trip
-        }
-        else if (!world[i].isOnVacation()) {
-            trip_lengths[i] = takes_trip_nonpeak(randomizer) * n_days(randomizer);
-        }
-    } //no else statement because if they are already on vacation we don't want to fuck with that
+RandomStream iterationStream(int n, bool antithetic) {
+    if (!antithetic) return RandomStream(seed, n);
+    RandomStream first (seed, n - n % 2);
+    return n % 2 == 1 ? first.antithetic() : first;
 }
-/*
-    Where will each Agent go on vacation?
-*/
-//std::uniform_int_distribution<> dis(0, 2);
-std::vector<int> subintervals = {0, 1, 2, 3};
-std::vector<double> weights = {POPULATION_GIBSONS / TOTAL_POPULATION, POPULATION_ROBERTSCREEK / TOTAL_POPULATION,
-    POPULATION_SECHELT / TOTAL_POPULATION};
-std::piecewise_constant_distribution<> d(subintervals.begin(), subintervals.end(), weights.begin());
-void getDestinations(std::vector<Agent>& world, std::vector<char>& destinations) {
-    for (int i (0); i < world.size(); ++i) {
-        if (world[i].getHome() == 'v') {
-            if (d(randomizer) < 1) destinations[i] = 'g';
-            else if (d(randomizer) >= 1 && d(randomizer) < 2) destinations[i] = 'r';
-            else destinations[i] = 's';
+void runScenarios(const std::vector<Scenario>& scenarios, char engine, int n_iterations, int t_max, int n_threads,
+    std::vector<int>& output_car_trips, std::vector<int>& output_bike_trips, const RunOptions& options) {
+    const std::string& snapshot_dir = options.snapshot_dir;
+    const std::string& population_cache = options.population_cache;
+    int fork_day = options.fork_day;
+    struct SharedBase {
+        std::once_flag built;
+        std::unique_ptr<Population> population;
+        std::atomic<int> users_left;
+    };
+    struct SharedWarmUp {
+        std::once_flag done;
+        std::unique_ptr<AgentModel> model;
+        std::vector<int> car_trips;
+        std::vector<int> bike_trips;
+        std::atomic<int> users_left;
+    };
+    if (fork_day > 0 && engine != 'a') throw std::runtime_error("fork_day only works with the agent engine (engine = a)");
+    if (fork_day > 0 && !options.common_random_numbers) throw std::runtime_error("fork_day needs common random numbers, the scenarios share their first days");
+    fork_day = std::min(fork_day, t_max);
+    std::unique_ptr<NetworkRoutes> built_in;
+    if (engine == 'n' && !options.network) built_in.reset(new NetworkRoutes(Network::sunshineCoast()));
+    NetworkRoutes* network = options.network ? options.network : built_in.get();
+    int n_scenarios = (int) scenarios.size();
+    std::vector<SharedBase> bases (n_iterations);
+    for (SharedBase& base : bases) base.users_left = n_scenarios;
+    auto id = [&](int scenario) {
+        return options.scenario_ids.empty() ? scenario : options.scenario_ids[scenario];
+    };
+    /*
+        The first scenario of the grid with the same agents as scenario s leads its group through the shared days, so
+        the groups and their snapshots stay the same when some of the scenarios have dropped out of a batch
+    */
+    const std::vector<Scenario>& grid = options.grid ? *options.grid : scenarios;
+    std::vector<int> leader (n_scenarios); //in the grid
+    std::vector<int> group (n_scenarios); //numbered by first appearance in scenarios
+    std::vector<int> group_leaders;
+    for (int s (0); s < n_scenarios; ++s) {
+        leader[s] = options.grid ? id(s) : s;
+        for (int l (0); l < leader[s]; ++l) {
+            if (grid[l].p_bike_if_lane == scenarios[s].p_bike_if_lane && grid[l].p_always_bike == scenarios[s].p_always_bike) {
+                leader[s] = l;
+                break;
+            }
+        }
+        group[s] = (int) (std::find(group_leaders.begin(), group_leaders.end(), leader[s]) - group_leaders.begin());
+        if (group[s] == (int) group_leaders.size()) group_leaders.push_back(leader[s]);
+    }
+    int n_groups = (int) group_leaders.size();
+    std::vector<SharedWarmUp> warm_ups (fork_day > 0 ? n_iterations * n_groups : 0); //indexed by (n, group)
+    for (std::size_t w (0); w < warm_ups.size(); ++w) {
+        warm_ups[w].users_left = (int) std::count(group.begin(), group.end(), (int) w % n_groups);
+    }
+    int n_tasks = n_iterations * n_scenarios;
+    int task_threads = std::min(n_threads, n_tasks);
+    int sweep_threads = std::max(1, n_threads / task_threads); //left over threads help with each iteration's daily sweep
+    int64_t shared_days = (int64_t) (n_tasks - n_iterations * n_groups) * fork_day; //simulated once for several scenarios
+    ProgressReporter progress ((int64_t) n_tasks * t_max - shared_days);
+    runInParallel(n_tasks, task_threads, [&](int task) {
+        int i = task / n_scenarios; //in this call, n is the iteration
+        int n = options.first_iteration + i;
+        int s = task % n_scenarios;
+        RandomStream randomizer = iterationStream(n, options.antithetic);
+        //what the days of the scenario draw from
+        RandomStream days_randomizer = options.common_random_numbers ? randomizer : randomizer.substream(STREAM_SCENARIO, id(s));
+        SharedBase& base = bases[i];
+        auto buildBase = [&]() {
+            std::call_once(base.built, [&]() {
+                RandomStream base_randomizer = iterationStream(n, options.antithetic);
+                base.population.reset(new Population());
+                buildBasePopulation(*base.population, base_randomizer, sweep_threads);
+            });
+        };
+        //the agents of scenario s: the base population with bikers, from the cache if they are in it
+        auto scenarioPopulation = [&](const Scenario& scenario) {
+            Population british_columbia;
+            PopulationKey key = {seed, (uint32_t) n, scenario.p_bike_if_lane, scenario.p_always_bike, options.antithetic};
+            std::string path;
+            if (!population_cache.empty()) {
+                path = populationCachePath(population_cache, key);
+                if (loadCachedPopulation(path, key, british_columbia)) return british_columbia;
+            }
+            buildBase();
+            british_columbia = *base.population;
+            assignBikers(british_columbia, scenario.p_bike_if_lane, scenario.p_always_bike, randomizer);
+            if (!path.empty()) saveCachedPopulation(path, key, british_columbia);
+            return british_columbia;
+        };
+        std::vector<int> scratch;
+        int* car_trips;
+        int* bike_trips;
+        if (output_car_trips.empty()) {
+            scratch.resize(2 * t_max);
+            car_trips = &scratch[0];
+            bike_trips = &scratch[t_max];
         }
         else {
-            destinations[i] = 'v';
+            std::size_t offset = ((std::size_t) s * n_iterations + i) * t_max;
+            car_trips = &output_car_trips[offset];
+            bike_trips = &output_bike_trips[offset];
         }
-    }
+        std::unique_ptr<SailingRecorder> recorder;
+        if (options.records) recorder.reset(new SailingRecorder(*options.records, id(s), n));
+        if (fork_day > 0) {
+            SharedWarmUp& warm = warm_ups[i * n_groups + group[s]];
+            std::call_once(warm.done, [&]() {
+                Snapshot::Info info;
+                info.seed = seed;
+                info.iteration = n;
+                info.antithetic = options.antithetic && n % 2 == 1;
+                info.day = fork_day;
+                info.scenario = grid[leader[s]];
+                warm.car_trips.resize(fork_day);
+                warm.bike_trips.resize(fork_day);
+                std::string path;
+                if (!snapshot_dir.empty()) {
+                    path = snapshot_dir + "/warmup_" + std::to_string(n) + "_" + std::to_string(options.grid ? leader[s] : id(leader[s])) + ".snap";
+                    if (std::ifstream(path)) {
+                        Snapshot snapshot(path);
+                        if (snapshot.matches(info)) {
+                            warm.model.reset(new AgentModel(snapshot.restore(sweep_threads, warm.car_trips.data(), warm.bike_trips.data())));
+                            progress.advance(fork_day);
+                            return;
+                        }
+                    }
+                }
+                warm.model.reset(new AgentModel(scenarioPopulation(info.scenario), info.scenario, randomizer, sweep_threads));
+                runAgentDays(*warm.model, 0, fork_day, warm.car_trips.data(), warm.bike_trips.data(), nullptr, progress);
+                if (!path.empty()) Snapshot::save(path, *warm.model, info, warm.car_trips.data(), warm.bike_trips.data());
+            });
+            AgentModel agents = *warm.model; //the fork
+            agents.setScenario(scenarios[s]);
+            std::copy(warm.car_trips.begin(), warm.car_trips.end(), car_trips);
+            std::copy(warm.bike_trips.begin(), warm.bike_trips.end(), bike_trips);
+            if (--warm.users_left == 0) warm.model.reset();
+            runAgentDays(agents, fork_day, t_max, car_trips, bike_trips, recorder.get(), progress);
+        }
+        else if (engine == 'n') runNetworkIteration(scenarios[s], *network, t_max, randomizer, days_randomizer, car_trips, bike_trips, recorder.get(), progress);
+        else if (engine == 'c') runCohortIteration(scenarios[s], t_max, days_randomizer, car_trips, bike_trips, recorder.get(), progress);
+        else if (engine == 'e') runEventIteration(scenarios[s], scenarioPopulation(scenarios[s]), t_max, days_randomizer, car_trips, bike_trips, recorder.get(), progress);
+        else runAgentIteration(scenarios[s], scenarioPopulation(scenarios[s]), t_max, days_randomizer, sweep_threads, car_trips, bike_trips, recorder.get(), progress);
+        if (--base.users_left == 0) base.population.reset();
+    });
+    progress.finish();
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     /*
-        Initialize agents. We will use a vector<Agent> but try not to do much with it because it will be computationally intensive.
-        First we define a vector, then we add items to it in accordance with the population of the areas in question:
-        Sechelt, Gibsons, Roberts Creek, and Metro Vancouver.
-        The population of Metro Vancouver is ~2.64 million people. The population of Sechelt is ~10 thousand, Gibsons about 5 thousand,
-        and Roberts Creek about 3 thousand.
-        All agents for now are non-bikers, later we will randomly assign some of the agents to be bikers.
+        Command line options. --seed N fixes the master seed so a run can be repeated exactly, --threads N sets how many
+        iterations run at the same time. The results only depend on the seed, not on the number of threads.
+        --config FILE or any of the scenario options in config.h (e.g. --bike_path n,r,s --p_bike_if_lane 0:1:0.1)
+        switch to batch mode, which runs the whole grid of scenarios without asking any questions.
+        --export FILE writes the sailing records in FILE (see records.h) to standard output as CSV and does nothing else.
+        --stats FILE writes the time spent in each phase of the model and a few counters to FILE at the end of the run
+        (see instrument.h).
     */
-    std::vector<Agent> british_columbia;
-    double j (0.0); //this avoids ad-hoc casting to int and a bunch of control flow
-    while (j < POPULATION_VANCOUVER) {
-        Agent agent('v', 'v', 'n'); //this is kinda ugly but it works. open to suggestions for making it cleaner
-        british_columbia.push_back(agent);
-        j += 1;
+    auto run_start = std::chrono::steady_clock::now();
+    int n_threads = defaultThreadCount();
+    BatchConfig batch;
+    std::string export_path;
+    std::string stats_path;
+    try {
+        //the files first, so the options on the command line override them wherever they are
+        for (int i (1); i + 1 < argc; i += 2) {
+            if (std::string(argv[i]) == "--config") readBatchFile(batch, argv[i + 1]);
+        }
+        for (int i (1); i < argc; ++i) {
+            std::string option = argv[i];
+            if (option.compare(0, 2, "--") != 0 || i + 1 >= argc) throw std::runtime_error("Unknown option " + option);
+            std::string value = argv[++i];
+            if (option == "--seed") seed = std::strtoull(value.c_str(), nullptr, 10);
+            else if (option == "--threads") n_threads = std::max(1, std::atoi(value.c_str()));
+            else if (option == "--config") continue; //read above
+            else if (option == "--export") export_path = value;
+            else if (option == "--stats") stats_path = value;
+            else if (!setBatchOption(batch, option.substr(2), value)) throw std::runtime_error("Unknown option " + option);
+        }
     }
-    j = 0.0;
-    while (j < POPULATION_SECHELT) {
-        Agent agent('s', 's', 'n');
-        british_columbia.push_back(agent);
-        j += 1;
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--seed N] [--threads N] [--stats FILE] [--config FILE] [--<batch option> VALUES ...]" << std::endl;
+        std::cerr << "       " << argv[0] << " --export RECORD_FILE > records.csv" << std::endl;
+        return 1;
     }
-    j = 0.0;
-    while (j < POPULATION_GIBSONS) {
-        Agent agent('g', 'g', 'n');
-        british_columbia.push_back(agent);
-        j += 1;
+    if (!export_path.empty()) {
+        try {
+            exportRecords(export_path, std::cout);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
     }
-    j = 0.0;
-    while (j < POPULATION_ROBERTSCREEK) {
-        Agent agent('r', 'r', 'n');
-        british_columbia.push_back(agent);
-        j += 1;
+    std::cout << "Master seed: " << seed << std::endl; //so the run can be repeated with --seed
+    int t_max = 365;
+    auto finish = [&]() {
+        if (stats_path.empty()) return 0;
+        try {
+            writeStats(stats_path, std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count());
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << stats_path << std::endl;
+        return 0;
+    };
+
+    if (batch.enabled) {
+        std::vector<Scenario> scenarios = batch.scenarios();
+        int n_scenarios = (int) scenarios.size();
+        if (batch.antithetic && batch.n_iterations % 2 != 0) {
+            std::cerr << "With antithetic = on the iterations come in pairs, so there must be an even number of them" << std::endl;
+            return 1;
+        }
+        if (batch.baseline && std::find(batch.bike_paths.begin(), batch.bike_paths.end(), batch.baseline) == batch.bike_paths.end()) {
+            std::cerr << "The baseline bike path " << batch.baseline << " is not one of the bike paths" << std::endl;
+            return 1;
+        }
+        if (!batch.differences.empty() && !batch.baseline) {
+            std::cerr << "differences needs a baseline to compare with" << std::endl;
+            return 1;
+        }
+        if (!batch.network.empty() && batch.engine != 'n') {
+            std::cerr << "network only works with the network engine (engine = n)" << std::endl;
+            return 1;
+        }
+        for (char path : batch.bike_paths) {
+            if (batch.engine != 'n' && path != 'n' && path != 'r' && path != 's') {
+                std::cerr << "bike_path " << path << " only exists on a route network, the other engines know n, r and s" << std::endl;
+                return 1;
+            }
+        }
+        std::unique_ptr<NetworkRoutes> network;
+        try {
+            if (batch.engine == 'n') network.reset(new NetworkRoutes(batch.network.empty() ? Network::sunshineCoast() : Network::load(batch.network)));
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        //the scenario each scenario is compared with, itself for the baselines and without comparisons
+        std::vector<int> baseline_of (n_scenarios);
+        for (int s (0); s < n_scenarios; ++s) {
+            baseline_of[s] = s;
+            Scenario wanted = scenarios[s];
+            if (batch.baseline) wanted.bike_path = batch.baseline;
+            for (int b (0); b < n_scenarios; ++b) if (sameScenario(scenarios[b], wanted)) baseline_of[s] = b;
+        }
+        bool adaptive = batch.precision > 0.0;
+        if (adaptive && batch.baseline) {
+            std::cout << "Running " << n_scenarios << " scenarios with up to " << batch.n_iterations << " iterations each, until the 95% "
+                << "intervals of the differences from bike path " << batch.baseline << " are within " << 100 * batch.precision
+                << "% of its trips for the year" << std::endl;
+        }
+        else if (adaptive) {
+            std::cout << "Running " << n_scenarios << " scenarios with up to " << batch.n_iterations << " iterations each, until the 95% "
+                << "intervals of the trips for the year are within " << 100 * batch.precision << "% of the mean" << std::endl;
+        }
+        else std::cout << "Running " << n_scenarios << " scenarios with " << batch.n_iterations << " iterations each" << std::endl;
+        /*
+            The iterations run in rounds. The daily trips of a round are folded into the statistics of each scenario
+            (statistics.h) and written to the output table, then thrown away, so the memory does not grow with the number
+            of iterations. The table comes in blocks of STATS_ROUND iterations, and in a block scenario by scenario and
+            iteration by iteration. Without a precision target every scenario gets all the iterations, and a round is
+            as many whole blocks as it takes to give every thread a task; the table is the same for any number of
+            threads. With one, the rounds are single blocks, and a scenario drops out as soon as its car and bike trips
+            for the year are precise enough, or everything stops when the time budget is used up. Which scenarios go on
+            only depends on the results, so apart from the time budget the run is as repeatable as any other.
+            With a baseline the differences of every iteration are folded in as well, and a baseline drops out together
+            with the scenarios compared with it, when all of their differences are precise enough, so the two sides of
+            a difference always have the same iterations. STATS_ROUND is even, so antithetic pairs are never split.
+        */
+        bool table = batch.output != "none";
+        std::vector<ScenarioStatistics> statistics (n_scenarios, ScenarioStatistics(t_max, batch.antithetic));
+        std::vector<ScenarioStatistics> differences (n_scenarios, ScenarioStatistics(t_max, batch.antithetic)); //from the baseline
+        std::vector<int> active;
+        for (int s (0); s < n_scenarios; ++s) active.push_back(s);
+        std::ofstream outf;
+        if (table) {
+            outf.open(batch.output);
+            if (!outf) {
+                std::cerr << "The file output failed." << std::endl;
+                return 1;
+            }
+            /*
+                One row per scenario, iteration and day, with the scenario's parameters in front so the file can be
+                filtered and grouped directly
+            */
+            outf << "Scenario,Bike Path,P Bike If Lane,P Always Bike,Ferries Per Day,Cars Per Ferry,Bikes Per Ferry,Balk Length,"
+                << "Iteration,Day,Car Trips to Coast,Bike Trips to Coast\n";
+        }
+        try {
+            std::unique_ptr<RecordWriter> records;
+            if (!batch.records.empty()) records.reset(new RecordWriter(batch.records));
+            auto batch_start = std::chrono::steady_clock::now();
+            //enough iterations in a round to keep every thread busy, in whole blocks of STATS_ROUND
+            int round = STATS_ROUND;
+            if (!adaptive) round *= (n_threads + STATS_ROUND * n_scenarios - 1) / (STATS_ROUND * n_scenarios);
+            for (int first (0); first < batch.n_iterations && !active.empty(); first += round) {
+                int n_round = std::min(round, batch.n_iterations - first);
+                std::vector<Scenario> running;
+                for (int s : active) running.push_back(scenarios[s]);
+                RunOptions options;
+                options.first_iteration = first;
+                options.scenario_ids = active;
+                options.grid = &scenarios;
+                options.records = records.get();
+                options.fork_day = batch.fork_day;
+                options.snapshot_dir = batch.snapshots;
+                options.population_cache = batch.population_cache;
+                options.common_random_numbers = batch.common_random_numbers;
+                options.antithetic = batch.antithetic;
+                options.network = network.get();
+                std::vector<int> output_car_trips (active.size() * n_round * t_max);
+                std::vector<int> output_bike_trips (active.size() * n_round * t_max);
+                runScenarios(running, batch.engine, n_round, t_max, n_threads, output_car_trips, output_bike_trips, options);
+                ScopedTimer timer(PHASE_OUTPUT);
+                for (int block (0); block < n_round; block += STATS_ROUND) {
+                    for (std::size_t a (0); a < active.size(); ++a) {
+                        int s = active[a];
+                        const Scenario& sc = scenarios[s];
+                        for (int i (block); i < std::min(block + STATS_ROUND, n_round); ++i) {
+                            std::size_t offset = (a * n_round + i) * t_max;
+                            statistics[s].addIteration(&output_car_trips[offset], &output_bike_trips[offset]);
+                            if (!table) continue;
+                            for (int t (0); t < t_max; ++t) {
+                                outf << s << "," << sc.bike_path << "," << sc.p_bike_if_lane << "," << sc.p_always_bike << ","
+                                    << sc.ferries_per_day << "," << sc.cars_per_ferry << "," << sc.bikes_per_ferry << "," << sc.balk_length << ","
+                                    << first + i << "," << t << "," << output_car_trips[offset + t] << "," << output_bike_trips[offset + t] << "\n";
+                            }
+                        }
+                    }
+                }
+                std::vector<int> slot (n_scenarios, -1); //where each scenario is in this round's output
+                for (std::size_t a (0); a < active.size(); ++a) slot[active[a]] = (int) a;
+                std::vector<int> car_difference (t_max), bike_difference (t_max);
+                for (int s : active) {
+                    if (baseline_of[s] == s) continue;
+                    for (int i (0); i < n_round; ++i) {
+                        std::size_t offset = ((std::size_t) slot[s] * n_round + i) * t_max;
+                        std::size_t base_offset = ((std::size_t) slot[baseline_of[s]] * n_round + i) * t_max;
+                        for (int t (0); t < t_max; ++t) {
+                            car_difference[t] = output_car_trips[offset + t] - output_car_trips[base_offset + t];
+                            bike_difference[t] = output_bike_trips[offset + t] - output_bike_trips[base_offset + t];
+                        }
+                        differences[s].addIteration(car_difference.data(), bike_difference.data());
+                    }
+                }
+                if (!adaptive) continue;
+                std::vector<char> precise (n_scenarios, 1); //by baseline, when there is one
+                for (int s : active) {
+                    int b = baseline_of[s];
+                    if (!batch.baseline) precise[s] = statistics[s].isPrecise(batch.precision);
+                    else if (b != s && !differences[s].isPrecise(batch.precision, statistics[b])) precise[b] = 0;
+                }
+                active.erase(std::remove_if(active.begin(), active.end(), [&](int s) {
+                    return precise[baseline_of[s]];
+                }), active.end());
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+                if (batch.time_budget > 0 && elapsed >= batch.time_budget && !active.empty()) {
+                    std::cout << "The time budget of " << batch.time_budget << " s is used up" << std::endl;
+                    break;
+                }
+            }
+            if (records) {
+                records->close();
+                std::cout << "Wrote " << batch.records << std::endl;
+            }
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if (table) {
+            outf.close();
+            if (!outf) {
+                std::cerr << "The file output failed." << std::endl;
+                return 1;
+            }
+            std::cout << "Wrote " << batch.output << std::endl;
+        }
+        if (!batch.summary.empty()) {
+            ScopedTimer timer(PHASE_OUTPUT);
+            std::ofstream summary(batch.summary);
+            summary << "Scenario,Bike Path,P Bike If Lane,P Always Bike,Ferries Per Day,Cars Per Ferry,Bikes Per Ferry,Balk Length,"
+                << "Day,Iterations,Car Mean,Car SD,Car CI Low,Car CI High,Car P5,Car Median,Car P95,"
+                << "Bike Mean,Bike SD,Bike CI Low,Bike CI High,Bike P5,Bike Median,Bike P95\n";
+            for (int s (0); s < n_scenarios; ++s) {
+                const Scenario& sc = scenarios[s];
+                for (int t (0); t < t_max; ++t) {
+                    summary << s << "," << sc.bike_path << "," << sc.p_bike_if_lane << "," << sc.p_always_bike << ","
+                        << sc.ferries_per_day << "," << sc.cars_per_ferry << "," << sc.bikes_per_ferry << "," << sc.balk_length << ","
+                        << t << "," << statistics[s].iterations() << ",";
+                    statistics[s].carTrips(t).writeColumns(summary);
+                    summary << ",";
+                    statistics[s].bikeTrips(t).writeColumns(summary);
+                    summary << "\n";
+                }
+            }
+            if (!summary) {
+                std::cerr << "Could not write the summary " << batch.summary << std::endl;
+                return 1;
+            }
+            std::cout << "Wrote " << batch.summary << std::endl;
+        }
+        if (!batch.differences.empty()) {
+            ScopedTimer timer(PHASE_OUTPUT);
+            std::ofstream deltas(batch.differences);
+            deltas << "Scenario,Baseline Scenario,Bike Path,P Bike If Lane,P Always Bike,Ferries Per Day,Cars Per Ferry,Bikes Per Ferry,"
+                << "Balk Length,Day,Iterations,Car Difference Mean,Car Difference SD,Car Difference CI Low,Car Difference CI High,"
+                << "Car Difference P5,Car Difference Median,Car Difference P95,Bike Difference Mean,Bike Difference SD,"
+                << "Bike Difference CI Low,Bike Difference CI High,Bike Difference P5,Bike Difference Median,Bike Difference P95\n";
+            for (int s (0); s < n_scenarios; ++s) {
+                if (baseline_of[s] == s) continue;
+                const Scenario& sc = scenarios[s];
+                for (int t (0); t < t_max; ++t) {
+                    deltas << s << "," << baseline_of[s] << "," << sc.bike_path << "," << sc.p_bike_if_lane << "," << sc.p_always_bike << ","
+                        << sc.ferries_per_day << "," << sc.cars_per_ferry << "," << sc.bikes_per_ferry << "," << sc.balk_length << ","
+                        << t << "," << differences[s].iterations() << ",";
+                    differences[s].carTrips(t).writeColumns(deltas);
+                    deltas << ",";
+                    differences[s].bikeTrips(t).writeColumns(deltas);
+                    deltas << "\n";
+                }
+            }
+            if (!deltas) {
+                std::cerr << "Could not write the differences " << batch.differences << std::endl;
+                return 1;
+            }
+            std::cout << "Wrote " << batch.differences << std::endl;
+        }
+        /*
+            For every comparison, the difference in bike trips for the year with its interval, and how many times more
+            iterations two independent runs would have needed for the same interval: the variance of the difference
+            of independent runs is the sum of the two variances.
+        */
+        for (int s (0); s < n_scenarios; ++s) {
+            int b = baseline_of[s];
+            if (b == s) continue;
+            const RunningStats& delta = differences[s].bikeTrips(t_max - 1).moments();
+            double independent = statistics[s].bikeTrips(t_max - 1).moments().variance() + statistics[b].bikeTrips(t_max - 1).moments().variance();
+            std::cout << "Scenario " << s << " - scenario " << b << ": bike trips " << delta.mean() << " +- " << delta.halfWidth();
+            if (delta.variance() > 0.0) std::cout << ", " << independent / delta.variance() << "x fewer iterations than independent runs";
+            std::cout << std::endl;
+        }
+        if (adaptive) {
+            for (int s (0); s < n_scenarios; ++s) {
+                const RunningStats& car = statistics[s].carTrips(t_max - 1).moments();
+                const RunningStats& bike = statistics[s].bikeTrips(t_max - 1).moments();
+                std::cout << "Scenario " << s << ": " << statistics[s].iterations() << " iterations, car trips " << car.mean() << " +- "
+                    << car.halfWidth() << ", bike trips " << bike.mean() << " +- " << bike.halfWidth()
+                    << (batch.baseline || statistics[s].isPrecise(batch.precision) ? "" : " (not precise enough yet)") << std::endl;
+            }
+        }
+        return finish();
     }
-    j = 0.0; //so we can use it again later. Efficiency!
 
-    std::vector<int> trip_lengths (british_columbia.size()); //declare a vector of trip lenghts the same size as the british columbia vector
-    std::vector<char> destinations (british_columbia.size());
-    bool peak_season (false);
     /*
         Now some agents are willing to bike, this is a user-defined variable. I assume 1% of people
         are die-hard cyclists willing to bike from Vancouver to the Sunshine Coast even absent a bike lane.
         That is a totally arbitrary choice, and there is code to make it a user-defined variable commented out
         below. It should not affect the model too much.
-
-        Once we know p_bike_if_lane we randomly assign some of the agents to be bike lane cyclists and some to be
-        die-hard cyclists.
     */
-    float p_bike_if_lane;
-    float p_always_bike (0.01);
+    Scenario scenario;
+    float& p_bike_if_lane = scenario.p_bike_if_lane;
+    char& bike_path = scenario.bike_path;
     int n_iterations;
+    char engine;
 
+    std::cout << "Which engine should run the model? Enter 'a' for agent-based, 'c' for cohort (counts of interchangeable agents)," << std::endl;
+    std::cout << "'e' for event-driven (agents are only simulated on the days they travel) or 'n' for event-driven on the built-in" << std::endl;
+    std::cout << "route network (network.h). Engine n uses the network's general routing rules, which differ from those of the" << std::endl;
+    std::cout << "other engines for some lane bikers, so its trips are not the same (see network_model.h)." << std::endl;
+    std::cin >> engine;
+    while (engine != 'a' && engine != 'c' && engine != 'e' && engine != 'n') {
+        std::cout << "Enter 'a' for agent-based, 'c' for cohort, 'e' for event-driven or 'n' for the route network. The input is case-sensitive." << std::endl;
+        std::cin >> engine;
+    }
     std::cout << "How long does the bike path extend? Enter 'n' for no path, 'r' for Roberts Creek, and 's' for Sechelt. (The input is case-sensitive.)" <<std::endl;
     std::cin >> bike_path;
     while (bike_path != 'n' && bike_path != 'r' && bike_path != 's') {
@@ -218,10 +664,10 @@ int main() {
         std::cout << "Enter the proportion again:" << std::endl;
         std::cin >> p_bike_if_lane; //janky input handling
     }
-    std::cout << "How many times to run the model, for later averaging purposes? (Must be an integer, max 100)." << std::endl;
+    std::cout << "How many times to run the model, for later averaging purposes? (Must be a positive integer.)" << std::endl;
     std::cin >> n_iterations;
-    while (n_iterations < 1 || n_iterations > 100) {
-        std::cout << "The number of iterations must be an integer between 1 and 100." << std::endl;
+    while (n_iterations < 1) {
+        std::cout << "The number of iterations must be a positive integer." << std::endl;
         std::cin >> n_iterations;
     }
 
@@ -230,27 +676,13 @@ int main() {
     */
     //std::cout << "What proportion of people are die-hard cyclists, who bike everywhere, even if there is no available lane?" << std::endl;
     //std::cout << "Enter the proportion as a decimal:" << std::endl;
-    //std::cin >> p_always_bike;
-    //while (p_always_bike > 1.0 || p_always_bike < 0.0) {
+    //std::cin >> scenario.p_always_bike;
+    //while (scenario.p_always_bike > 1.0 || scenario.p_always_bike < 0.0) {
     //    std::cout << "The proportion of die-hard cyclists must be a number between 0 and 1, expressed as a decimal." << std::endl;
     //    std::cout << "Enter the proportion again:" << std::endl;
-    //    std::cin >> p_always_bike;
+    //    std::cin >> scenario.p_always_bike;
     //}
-    std::bernoulli_distribution p_lane_biker (p_bike_if_lane); //i am bad at thinking of variable names
-    std::bernoulli_distribution  p_die_hard (p_always_bike);
-    bool coin;
-    for (int i (0); i < british_columbia.size(); ++i) {
-        coin = p_die_hard(randomizer);
-        if (coin) {
-            british_columbia[i].setBike('y');
-        }
-        else {
-            coin = p_lane_biker(randomizer);
-            if (coin) {
-                british_columbia[i].setBike('p');
-            }
-        }
-    }
+
     /*
         For ease of analysis and preservation, output the data to a file
     */
@@ -273,169 +705,27 @@ int main() {
         outf << std::endl;
     }
 
-    int car_trips_to_coast (0);
-    int bike_trips_to_coast (0);
-    int car_trips_to_van (0);
-    int bike_trips_to_van (0);
-
-    /*
-        Define ferry queues. These are all deque<int> so we can work with indices rather than
-        directly with agents, which are more computationally costly; and so we have easy insertion
-        and deletion at both ends of the queue
-    */
-    std::deque<int> ferry_cvg; //car, vancouver to gibsons
-    std::deque<int> ferry_bvg; //bike, vancouver to gibsons
-    std::deque<int> ferry_cgv; //car, gibsons to vancouver
-    std::deque<int> ferry_bgv; //bike, gibsons to vancouver
-
-    int passengers_cvg (0);
-    int passengers_bgv (0);
-    int passengers_cgv (0);
-    int passengers_bvg (0);
-
-    int t_max = 365;
-    getDestinations(british_columbia, destinations);
-
     /*
-        To make it easy to do multiple iterations, store the data in three vectors and then output the vectors to a file.
-        Since we are going to iterate through it in order of entries at the end, the best idea is to think about it like a 2d
-        array, where the rows are days and the columns are iterations. In that case the data series of iteration n
-        on day t would be output[t][n]. But this is a 1d vector, so we need to make a translation. We know that
-        the width (number of columns) of that 2d array would be n_iterations. Therefore, we have
-        output[t][n] = one_dimensional_output[t + (int) n / n_iterations]
+        To make it easy to do multiple iterations, store the data in two vectors and then output the vectors to a file.
+        Think about it like a 2d array where the rows are iterations and the columns are days, so that every iteration
+        writes its own contiguous block of t_max entries: output[n][t] = one_dimensional_output[n * t_max + t]
     */
-    std::vector<int> output_car_trips (n_iterations * 365);
-    std::vector<int> output_bike_trips (n_iterations * 365);
-
-    for (int n (0); n < n_iterations; ++n) {
-        for (int t (0); t < t_max; ++t) { //main loop for the days of the year
-            std::cout << "This is day " <<  t << std::endl;
-            // outf << t << ","; old output
-            if (t >= 151 && t <= 243) peak_season = true;
-            else peak_season = false;
-            // logic for putting agents in ferries goes here
-            getTripLengths(british_columbia, trip_lengths, peak_season);
-            for (int k (0); k < british_columbia.size(); ++k) {
-                if (!british_columbia[k].isOnVacation() && trip_lengths[k] > 0) { //go on vacation
-                    /*
-                        The code below checks a bunch of possible cases. I don't know a good way of simplifying it, and
-                        this is definitely going to be a computational bottleneck. This is what we call "evil physics student code."
-                    */
-                    if (destinations[k] != 'v' && british_columbia[k].willBike() == 'y') {
-                        ferry_bvg.push_back(k);
-                    }
-                    else if (destinations[k] != 'v' && british_columbia[k].willBike() == 'n') {
-                        ferry_cvg.push_back(k);
-                    }
-                    else if (destinations[k] != 'v' && british_columbia[k].willBike() == 'p' && (destinations[k] == bike_path)) {
-                        ferry_bvg.push_back(k);
-                    }
-                    else if (destinations[k] != 'v' && british_columbia[k].willBike() == 'p' && (destinations[k] != bike_path)) {
-                        ferry_cvg.push_back(k);
-                    }
-                    else if (destinations[k] == 'v' && british_columbia[k].willBike() == 'n') {
-                        ferry_cgv.push_back(k);
-                    }
-                    else if (destinations[k] == 'v' && british_columbia[k].willBike() == 'y') {
-                        ferry_bgv.push_back(k);
-                    }
-                    else if (destinations[k] == 'v' && british_columbia[k].willBike() == 'p' && british_columbia[k].getHome() == 'g') {
-                        ferry_bgv.push_back(k);
-                    }
-                    else if (destinations[k] == 'v' && british_columbia[k].willBike() == 'p' &&
-                        (british_columbia[k].getHome() == bike_path || (bike_path == 's' && british_columbia[k].getHome() == 'r'))) {
-                        ferry_bgv.push_back(k);
-                    }
-                    else {
-                        ferry_cgv.push_back(k);
-                    }
-                }
-                else if (british_columbia[k].isOnVacation() && trip_lengths[k] <= 0) { //return home
-                    if (british_columbia[k].getLocation() == 'v' && british_columbia[k].willBike() == 'y') {
-                        ferry_bvg.push_back(k);
-                    }
-                    else if (british_columbia[k].getLocation() == 'v' && british_columbia[k].willBike() == 'n') {
-                        ferry_cvg.push_back(k);
-                    }
-                    else if (british_columbia[k].getLocation() == 'v' && british_columbia[k].willBike() == 'p'
-                        && british_columbia[k].getHome() == bike_path) {
-                            ferry_bvg.push_back(k); //decide to bike
-                    }
-                    else if (british_columbia[k].getLocation() == 'v' && british_columbia[k].willBike() == 'p'
-                        && british_columbia[k].getHome() != bike_path) {
-                            ferry_cvg.push_back(k); //decide not to bike
-                        }
-                    else if (british_columbia[k].getLocation() != 'v' && british_columbia[k].willBike() == 'y') {
-                        ferry_bgv.push_back(k);
-                    }
-                    else if (british_columbia[k].getLocation() != 'v' && british_columbia[k].willBike() == 'n') {
-                        ferry_cgv.push_back(k);
-                    }
-                    else if (british_columbia[k].getLocation() != 'v' && british_columbia[k].willBike() == 'p'
-                        && bike_path == 'n') {
-                            ferry_cgv.push_back(k);
-                        }
-                    else if (british_columbia[k].getLocation() == 's' && british_columbia[k].willBike() == 'p'
-                        && bike_path == 's') {
-                            ferry_bgv.push_back(k);
-                        }
-                    else if (british_columbia[k].getLocation() == 's' && british_columbia[k].willBike() == 'p'
-                        && bike_path != 's') {
-                            ferry_cgv.push_back(k);
-                        }
-                    else if ((british_columbia[k].getLocation() == 'r' || british_columbia[k].getLocation() == 'g')
-                        && british_columbia[k].willBike() == 'p' && bike_path != 'n') {
-                            ferry_bgv.push_back(k);
-                        }
-                    else { //hopefully we do not need this
-                        std::cout << "You're missing a case. Failed to classify the agent with the following characteristics:" <<std::endl;
-                        std::cout << "Location: " << british_columbia[k].getLocation() << std::endl;
-                        std::cout << "Willingness to Bike: " << british_columbia[k].willBike() << std::endl;
-                        std::cout << "Home: " << british_columbia[k].getHome() << std::endl;
-                    }
-                }
-                else if (british_columbia[k].isOnVacation() && trip_lengths[k] > 0) {
-                    --trip_lengths[k]; //one vacation day over
-                }
-            }
-            /*
-                This is ugly and slow but deals with the problem of the ferry being underbooked. I am sure there is a faster and better way
-                of doing this, but I do not know what it is right now.
-            */
-            for (int i (0); i < FERRIES_PER_DAY; ++i) {
-                passengers_bvg = std::min(BIKES_PER_FERRY, (int) ferry_bvg.size());
-                passengers_bgv = std::min(BIKES_PER_FERRY, (int) ferry_bgv.size());
-                passengers_cgv = std::min(CARS_PER_FERRY, (int) ferry_cgv.size());
-                passengers_cvg = std::min(CARS_PER_FERRY, (int) ferry_cvg.size());
-
-                for (int m (0); m < passengers_bvg; ++m) british_columbia[ferry_bvg[m]].setLocation(destinations[ferry_bvg[m]]);
-                ferry_bvg.erase(ferry_bvg.begin(), ferry_bvg.begin() + passengers_bvg);
-                bike_trips_to_coast += passengers_bvg;
-                for (int n (0); n < passengers_bgv; ++n) british_columbia[ferry_bgv[n]].setLocation(destinations[ferry_bgv[n]]);
-                ferry_bgv.erase(ferry_bgv.begin(), ferry_bgv.begin() + passengers_bgv);
-                bike_trips_to_van += passengers_bgv;
-                for (int h (0); h < passengers_cgv; ++h) british_columbia[ferry_cgv[h]].setLocation(destinations[ferry_cgv[h]]);
-                ferry_cgv.erase(ferry_cgv.begin(), ferry_cgv.begin() + passengers_cgv);
-                car_trips_to_van += passengers_cgv;
-                for (int g (0); g < passengers_cvg; ++g) british_columbia[ferry_cvg[g]].setLocation(destinations[ferry_cvg[g]]);
-                ferry_cvg.erase(ferry_cvg.begin(), ferry_cvg.begin() + passengers_cvg);
-                car_trips_to_coast += passengers_cvg;
-            }
-            //outf << car_trips_to_coast << "," << bike_trips_to_coast << std::endl; //old output method
-            output_car_trips[n * n_iterations + t] = car_trips_to_coast;
-            output_bike_trips[n * n_iterations + t] = bike_trips_to_coast;
-            //new output method writes to vector first then vector to file, using Row-major order
-        }
-    }
+    std::vector<int> output_car_trips (n_iterations * t_max);
+    std::vector<int> output_bike_trips (n_iterations * t_max);
+    runScenarios({scenario}, engine, n_iterations, t_max, n_threads, output_car_trips, output_bike_trips, RunOptions());
     /*
         Now write the vector output to the output file
     */
-    for (int t (0); t < t_max; ++t) {
-        outf << t;
-        for (int n (0); n < n_iterations; ++n) {
-            outf << "," << output_car_trips[n * n_iterations + t] << "," << output_bike_trips[n * n_iterations + t];
+    {
+        ScopedTimer timer(PHASE_OUTPUT);
+        for (int t (0); t < t_max; ++t) {
+            outf << t;
+            for (int n (0); n < n_iterations; ++n) {
+                outf << "," << output_car_trips[n * t_max + t] << "," << output_bike_trips[n * t_max + t];
+            }
+            outf << "\n";
         }
-        outf << std::endl;
+        outf.flush();
     }
-    return 0;
+    return finish();
 }
@@ -0,0 +1,73 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+    A read-only view of a whole file: mapped where we can, read into memory elsewhere
+*/
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef MAPPED_FILE_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open " + path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not read " + path);
+        }
+        length = (std::size_t) info.st_size;
+        if (length > 0) {
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Could not map " + path);
+            }
+            bytes = (const char*) mapped;
+        }
+        ::close(fd); //the mapping stays valid
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("Could not open " + path);
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        bytes = copy.data();
+        length = copy.size();
+#endif
+    }
+    ~MappedFile() {
+#ifdef MAPPED_FILE_HAVE_MMAP
+        if (bytes) ::munmap((void*) bytes, length);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return bytes;
+    }
+    std::size_t size() const {
+        return length;
+    }
+
+private:
+    const char* bytes = nullptr;
+    std::size_t length = 0;
+#ifndef MAPPED_FILE_HAVE_MMAP
+    std::vector<char> copy;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,222 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <chrono> //for seeding PRNGs
+#include "population.h"
+#include "rng.h"
+#include "sampling.h"
+/*
+    Everything the engines share: the global constants of the model, the random number setup, the destination weights
+    and the rules for which ferry queue an agent joins. See main.cpp for the structure of the algorithm.
+*/
+
+/*
+    Global constants
+*/
+const float MODEL_SCALE (2.7); //the number of people per agent in the model
+const int CARS_PER_FERRY (311 / MODEL_SCALE); //how many cars each ferry takes
+const int BIKES_PER_FERRY (1000 / MODEL_SCALE); //how many bikes each ferry takes, these numbers are currently just placeholders
+const int FERRIES_PER_DAY (4);
+const int MAX_FERRIES_PER_DAY (65535); //the sailings of a day are numbered in 16 bits in the record files (records.h)
+const double POPULATION_VANCOUVER (2.64e6); //scientific notation, 2.64e6 = 2.64*10^6 = 2.64 million
+const double POPULATION_SECHELT (1.0e4); //i want the extra precision of a double for these big numbers.
+const double POPULATION_GIBSONS (5.0e3);
+const double POPULATION_ROBERTSCREEK (3.0e3);
+const double TOTAL_POPULATION = POPULATION_SECHELT + POPULATION_GIBSONS + POPULATION_ROBERTSCREEK;
+
+/*
+    The parameters that change from one scenario to the next. The defaults come from the global constants above;
+    bike_path and p_bike_if_lane are asked for interactively or come from a batch configuration (see config.h).
+*/
+struct Scenario {
+    char bike_path = 'u'; //4 values: u for unset, n for "none," r for "only to robert's creek," and s for "all the way to sechelt"
+    float p_bike_if_lane = 0.0; //proportion of people willing to bike if there is a path
+    float p_always_bike = 0.01; //proportion of die-hard cyclists, see main()
+    int ferries_per_day = FERRIES_PER_DAY;
+    int cars_per_ferry = CARS_PER_FERRY;
+    int bikes_per_ferry = BIKES_PER_FERRY;
+    int balk_length = 0; //agents don't join a queue that is already this long, 0 means nobody balks
+};
+
+/*
+    The balk point from the design notes: an agent who finds queue_length agents already waiting does not join. Someone
+    leaving home gives up on the trip; someone coming home stays another day and tries again tomorrow.
+*/
+inline bool balks(std::size_t queue_length, const Scenario& scenario) {
+    return scenario.balk_length > 0 && queue_length >= (std::size_t) scenario.balk_length;
+}
+
+/*
+    Randomness setup
+    Where do the magic numbers come from? The total estimated spend by tourists is 250*10^6 CA$. The average person
+    spends $245 per trip. I assume (totally arbitrary) that 2/3 of the money is spent in the peak season (in other words that
+    on average twice as many people visit during the peak season compared to the rest of the year). That just seemed
+    reasonable, I couldn't get any reliable information on whether that is true or not. That yields a split of $83*10^6 in the off
+    season and $166*10^6 in the peak season. Dividing that by the average spend per person yields 3.4 * 10^5 people in
+    the non-peak season and 6.8*10^5 people in the peak season. The peak season is 90 days, so 7555 people/day on average,
+    and for the non-peak season 1259 people/day. Note that these numbers are really the average number of trips that begin every day,
+    not the total number of tourists there at a time. There are about 3*10^6 people in Vancouver, using that as the denominator yields
+    that during the peak season the individual propensity to take a trip (takes_trip_peak) is 0.0025; during the off season that number
+    is 0.00042 (takes_trip_nonpeak). We then multiply by the model scale to make sure we are working with agents rather than
+    people.
+    Every iteration draws from its own RandomStream (rng.h) keyed by the master seed and the iteration number, so that
+    iterations can run on any number of threads and still give the same results for the same seed. The distributions
+    below are shared; the engines work on copies of them so that no two threads touch the same object. They are inline
+    variables, so every file that includes this header sees the same ones (main.cpp sets seed).
+*/
+inline uint64_t seed = std::chrono::high_resolution_clock::now().time_since_epoch().count(); //master seed, can be set with --seed
+inline std::poisson_distribution<> n_days(3.3); //the average trip length is 3.3 nights
+inline std::bernoulli_distribution takes_trip_peak(0.0025 * MODEL_SCALE); //chance per day the agent wants to take a trip to the sunshine coast
+inline std::bernoulli_distribution takes_trip_nonpeak(0.00042 * MODEL_SCALE); //see above for explanation of magic numbers
+const int PEAK_SEASON_START (151); //first and last day of the peak season
+const int PEAK_SEASON_END (243);
+inline bool isPeakSeason(int day) {
+    return day >= PEAK_SEASON_START && day <= PEAK_SEASON_END;
+}
+/*
+    Where will each Agent go on vacation? People from Vancouver pick one of the three coast communities in proportion to
+    their populations, people from the coast always go to Vancouver.
+*/
+inline std::vector<double> weights = {POPULATION_GIBSONS / TOTAL_POPULATION, POPULATION_ROBERTSCREEK / TOTAL_POPULATION,
+    POPULATION_SECHELT / TOTAL_POPULATION};
+
+/*
+    The same distributions for the batch samplers (sampling.h) in the agent-based sweep. Deciding to go and then drawing
+    a length of 0 is the same as not going, so the daily draw is "starts a trip of at least one day", followed by a
+    zero-truncated length for the few agents who do.
+*/
+const uint32_t trip_start_peak = probabilityThreshold(takes_trip_peak.p() * (1.0 - std::exp(-n_days.mean())));
+const uint32_t trip_start_nonpeak = probabilityThreshold(takes_trip_nonpeak.p() * (1.0 - std::exp(-n_days.mean())));
+const CategoricalSampler trip_length_sampler = zeroTruncatedPoisson(n_days.mean(), Population::MAX_TRIP_DAYS);
+const CategoricalSampler destination_sampler (weights);
+
+/*
+    Ferry queues. There are two directions and two modes, so four queues
+*/
+enum FerryQueue : uint8_t {
+    QUEUE_CVG = 0, //car, vancouver to gibsons
+    QUEUE_BVG = 1, //bike, vancouver to gibsons
+    QUEUE_CGV = 2, //car, gibsons to vancouver
+    QUEUE_BGV = 3, //bike, gibsons to vancouver
+    N_QUEUES = 4,
+    NO_QUEUE = N_QUEUES //the agent could not be classified, see chooseQueue
+};
+
+/*
+    Which queue does an agent join? returning is false for an agent leaving home and true for an agent coming back
+    from vacation, bike_path is the scenario's bike path. This checks a bunch of possible cases. I don't know a good way of simplifying it, and
+    this is definitely going to be a computational bottleneck. This is what we call "evil physics student code."
+    (It still is the definition of the rules, but the daily loops use the RoutingTable below, which is built from it.)
+*/
+constexpr FerryQueue chooseQueue(Place home, Place location, Place destination, BikeType will_bike, bool returning, char bike_path) {
+    if (!returning) { //go on vacation
+        if (destination != VANCOUVER && will_bike == ALWAYS_BIKES) return QUEUE_BVG;
+        else if (destination != VANCOUVER && will_bike == NEVER_BIKES) return QUEUE_CVG;
+        else if (destination != VANCOUVER && will_bike == BIKES_IF_PATH && (placeToChar(destination) == bike_path)) return QUEUE_BVG;
+        else if (destination != VANCOUVER && will_bike == BIKES_IF_PATH && (placeToChar(destination) != bike_path)) return QUEUE_CVG;
+        else if (destination == VANCOUVER && will_bike == NEVER_BIKES) return QUEUE_CGV;
+        else if (destination == VANCOUVER && will_bike == ALWAYS_BIKES) return QUEUE_BGV;
+        else if (destination == VANCOUVER && will_bike == BIKES_IF_PATH && home == GIBSONS) return QUEUE_BGV;
+        else if (destination == VANCOUVER && will_bike == BIKES_IF_PATH &&
+            (placeToChar(home) == bike_path || (bike_path == 's' && home == ROBERTS_CREEK))) return QUEUE_BGV;
+        else return QUEUE_CGV;
+    }
+    else { //return home
+        if (location == VANCOUVER && will_bike == ALWAYS_BIKES) return QUEUE_BVG;
+        else if (location == VANCOUVER && will_bike == NEVER_BIKES) return QUEUE_CVG;
+        else if (location == VANCOUVER && will_bike == BIKES_IF_PATH && placeToChar(home) == bike_path) return QUEUE_BVG; //decide to bike
+        else if (location == VANCOUVER && will_bike == BIKES_IF_PATH && placeToChar(home) != bike_path) return QUEUE_CVG; //decide not to bike
+        else if (location != VANCOUVER && will_bike == ALWAYS_BIKES) return QUEUE_BGV;
+        else if (location != VANCOUVER && will_bike == NEVER_BIKES) return QUEUE_CGV;
+        else if (location != VANCOUVER && will_bike == BIKES_IF_PATH && bike_path == 'n') return QUEUE_CGV;
+        else if (location == SECHELT && will_bike == BIKES_IF_PATH && bike_path == 's') return QUEUE_BGV;
+        else if (location == SECHELT && will_bike == BIKES_IF_PATH && bike_path != 's') return QUEUE_CGV;
+        else if ((location == ROBERTS_CREEK || location == GIBSONS) && will_bike == BIKES_IF_PATH && bike_path != 'n') return QUEUE_BGV;
+        else return NO_QUEUE; //hopefully we do not need this
+    }
+}
+
+/*
+    The same decision as a lookup table. Everything chooseQueue looks at is in an agent's packed places byte (home,
+    location, will_bike and destination, see population.h), and an agent in the daily sweep is returning exactly when
+    location != home, so the queue is one load indexed by that byte instead of up to ten comparisons. There is one
+    table per bike path, built at compile time, and the sweep is instantiated once per bike_path value.
+*/
+struct RoutingTable {
+    uint8_t queue[256]; //a FerryQueue, indexed by Population::pack(home, location, will_bike, destination)
+};
+
+template <char bike_path>
+constexpr RoutingTable buildRoutingTable() {
+    RoutingTable table {};
+    for (int i (0); i < 256; ++i) table.queue[i] = NO_QUEUE; //will_bike == 3 is not a real agent
+    for (int h (VANCOUVER); h <= SECHELT; ++h)
+    for (int l (VANCOUVER); l <= SECHELT; ++l)
+    for (int b (NEVER_BIKES); b <= BIKES_IF_PATH; ++b)
+    for (int d (VANCOUVER); d <= SECHELT; ++d) {
+        Place home = (Place) h, location = (Place) l, destination = (Place) d;
+        BikeType will_bike = (BikeType) b;
+        table.queue[Population::pack(home, location, will_bike, destination)] =
+            chooseQueue(home, location, destination, will_bike, location != home, bike_path);
+    }
+    return table;
+}
+
+template <char bike_path>
+struct Routing {
+    static constexpr RoutingTable table = buildRoutingTable<bike_path>();
+};
+
+/*
+    Exhaustive checks, done by the compiler. Every byte decodes back to the same answer as the if/else chain, and no
+    agent the model can actually contain (destination different from home, at home or at the destination) falls
+    through to NO_QUEUE, so the "You're missing a case" branch in the old loop could never be taken.
+*/
+template <char bike_path>
+constexpr bool routingTableIsExact() {
+    for (int i (0); i < 256; ++i) {
+        Place home = (Place) (i & 3), location = (Place) ((i >> 2) & 3), destination = (Place) (i >> 6);
+        BikeType will_bike = (BikeType) ((i >> 4) & 3);
+        if (will_bike > BIKES_IF_PATH) {
+            if (Routing<bike_path>::table.queue[i] != NO_QUEUE) return false;
+            continue;
+        }
+        if (Routing<bike_path>::table.queue[i] != chooseQueue(home, location, destination, will_bike, location != home, bike_path)) return false;
+        bool real_agent = destination != home && (location == home || location == destination);
+        if (real_agent && Routing<bike_path>::table.queue[i] == NO_QUEUE) return false;
+    }
+    return true;
+}
+static_assert(routingTableIsExact<'n'>(), "routing table for bike_path n does not match chooseQueue");
+static_assert(routingTableIsExact<'r'>(), "routing table for bike_path r does not match chooseQueue");
+static_assert(routingTableIsExact<'s'>(), "routing table for bike_path s does not match chooseQueue");
+
+/*
+    The table for a bike_path only known at run time, for code that is not worth instantiating three times
+*/
+inline const RoutingTable& routingTable(char bike_path) {
+    switch (bike_path) {
+        case 'r': return Routing<'r'>::table;
+        case 's': return Routing<'s'>::table;
+        default: return Routing<'n'>::table;
+    }
+}
+
+inline bool isBikeQueue(int queue) {
+    return queue == QUEUE_BVG || queue == QUEUE_BGV;
+}
+inline bool isToCoast(int queue) {
+    return queue == QUEUE_CVG || queue == QUEUE_BVG;
+}
+/*
+    Every sailing boards the queues in this order, up to the ferry's room for bikes or cars
+*/
+const FerryQueue BOARDING_ORDER[N_QUEUES] = {QUEUE_BVG, QUEUE_BGV, QUEUE_CGV, QUEUE_CVG};
+inline int ferryCapacity(FerryQueue queue, const Scenario& scenario) {
+    return isBikeQueue(queue) ? scenario.bikes_per_ferry : scenario.cars_per_ferry;
+}
+
+#endif // MODEL_H
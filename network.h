@@ -0,0 +1,317 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "model.h"
+/*
+    __ROUTE NETWORK__
+    The four places and the one ferry of model.h are built into the packed agents (two bits per place) and into the
+    routing rules, so they cannot grow. The network engine (network_model.h) reads the geography from a file instead
+    (network = FILE in a batch), one connection or place per line, # starts a comment:
+
+        location vancouver 2640000          # name, population
+        location horseshoe_bay 0
+        location langdale 0
+        location gibsons 5000
+        ferry horseshoe_bay langdale sailings=8 cars=115 bikes=370
+        road vancouver horseshoe_bay
+        road langdale gibsons bike_path=rs  # the bike paths (as in the scenarios) under which this road has a lane
+
+    Every connection goes both ways. A ferry without sailings, cars or bikes takes the scenario's ferries_per_day,
+    cars_per_ferry or bikes_per_ferry, so the usual batch grids work on any network. The locations get the ids 0, 1, ...
+    in the order of the file, and the connections are kept as a compressed sparse row graph: the links out of location
+    l are links[first_link[l]] .. links[first_link[l + 1] - 1], one contiguous read per place.
+    Each ferry route has the four queues of model.h, numbered as FerryQueue with "to the coast" meaning from the first
+    terminal in its line to the second: queue ferry * N_QUEUES + q. The first ferry in the file is the one whose trips
+    go in the output table.
+*/
+
+enum LinkKind : uint8_t {
+    LINK_ROAD = 0,
+    LINK_FERRY = 1
+};
+
+/*
+    One direction of a connection
+*/
+struct Link {
+    uint16_t to;
+    uint8_t kind;
+    uint8_t direction; //ferries: 0 from the first terminal to the second, 1 back
+    uint32_t ferry; //ferries: index in Network::ferries
+    uint32_t bike_lanes; //roads: bit c - 'a' is set if the road has a lane with bike_path = c
+};
+
+struct FerryRoute {
+    uint16_t terminals[2];
+    int sailings_per_day = -1; //-1 means the scenario's
+    int cars_per_sailing = -1;
+    int bikes_per_sailing = -1;
+};
+
+class Network {
+public:
+    std::size_t locations() const {
+        return names.size();
+    }
+    const std::string& name(int l) const {
+        return names[l];
+    }
+    double population(int l) const {
+        return populations[l];
+    }
+    const Link* linksBegin(int l) const {
+        return links.data() + first_link[l];
+    }
+    const Link* linksEnd(int l) const {
+        return links.data() + first_link[l + 1];
+    }
+    std::size_t ferryRoutes() const {
+        return ferries.size();
+    }
+    const FerryRoute& ferry(int f) const {
+        return ferries[f];
+    }
+    int sailingsPerDay(int f, const Scenario& scenario) const {
+        return ferries[f].sailings_per_day >= 0 ? ferries[f].sailings_per_day : scenario.ferries_per_day;
+    }
+    int capacity(int f, FerryQueue q, const Scenario& scenario) const {
+        if (isBikeQueue(q)) return ferries[f].bikes_per_sailing >= 0 ? ferries[f].bikes_per_sailing : scenario.bikes_per_ferry;
+        return ferries[f].cars_per_sailing >= 0 ? ferries[f].cars_per_sailing : scenario.cars_per_ferry;
+    }
+
+    /*
+        Read a network in the format above; where is the file name for the error messages
+    */
+    static Network parse(std::istream& in, const std::string& where) {
+        Network network;
+        struct Connection {
+            int a, b;
+            uint8_t kind;
+            uint32_t ferry;
+            uint32_t bike_lanes;
+        };
+        std::vector<Connection> connections;
+        std::string line;
+        int line_number = 0;
+        while (std::getline(in, line)) {
+            ++line_number;
+            std::size_t comment = line.find('#');
+            if (comment != std::string::npos) line.erase(comment);
+            std::istringstream words(line);
+            std::string what;
+            if (!(words >> what)) continue; //blank line
+            std::string here = where + ":" + std::to_string(line_number) + ": ";
+            if (what == "location") {
+                std::string name;
+                double people;
+                if (!(words >> name >> people) || people < 0.0) throw std::runtime_error(here + "expected location NAME POPULATION");
+                if (network.find(name) >= 0) throw std::runtime_error(here + "location " + name + " is there twice");
+                network.names.push_back(name);
+                network.populations.push_back(people);
+                if (network.names.size() > UINT16_MAX) throw std::runtime_error(here + "too many locations");
+                continue;
+            }
+            if (what != "ferry" && what != "road") throw std::runtime_error(here + "expected location, ferry or road");
+            std::string from, to;
+            if (!(words >> from >> to)) throw std::runtime_error(here + "expected " + what + " FROM TO");
+            Connection c = {network.find(from), network.find(to), what == "ferry" ? LINK_FERRY : LINK_ROAD, 0, 0};
+            if (c.a < 0 || c.b < 0) throw std::runtime_error(here + "unknown location " + (c.a < 0 ? from : to) + ", locations come first");
+            if (c.a == c.b) throw std::runtime_error(here + "a connection needs two different places");
+            FerryRoute route;
+            route.terminals[0] = (uint16_t) c.a;
+            route.terminals[1] = (uint16_t) c.b;
+            std::string option;
+            while (words >> option) {
+                std::size_t equals = option.find('=');
+                std::string key = option.substr(0, equals);
+                std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+                if (c.kind == LINK_ROAD && key == "bike_path") {
+                    for (char letter : value) {
+                        if (letter < 'a' || letter > 'z') throw std::runtime_error(here + "bike_path takes letters, like rs");
+                        c.bike_lanes |= 1u << (letter - 'a');
+                    }
+                    continue;
+                }
+                int* field = nullptr;
+                if (c.kind == LINK_FERRY && key == "sailings") field = &route.sailings_per_day;
+                else if (c.kind == LINK_FERRY && key == "cars") field = &route.cars_per_sailing;
+                else if (c.kind == LINK_FERRY && key == "bikes") field = &route.bikes_per_sailing;
+                if (!field) throw std::runtime_error(here + "unknown " + what + " option " + key);
+                std::istringstream number(value);
+                if (!(number >> *field) || !number.eof() || *field < 0) throw std::runtime_error(here + key + " must be a whole number");
+                if (field == &route.sailings_per_day && *field > MAX_FERRIES_PER_DAY) {
+                    throw std::runtime_error(here + "at most " + std::to_string(MAX_FERRIES_PER_DAY) + " sailings a day");
+                }
+            }
+            if (c.kind == LINK_FERRY) {
+                c.ferry = (uint32_t) network.ferries.size();
+                network.ferries.push_back(route);
+            }
+            connections.push_back(c);
+        }
+        if (network.ferries.empty()) throw std::runtime_error(where + " has no ferry");
+        //counting sort of both directions of every connection by where they start
+        std::size_t n = network.locations();
+        network.first_link.assign(n + 1, 0);
+        for (const Connection& c : connections) {
+            ++network.first_link[c.a + 1];
+            ++network.first_link[c.b + 1];
+        }
+        for (std::size_t l (0); l < n; ++l) network.first_link[l + 1] += network.first_link[l];
+        network.links.resize(network.first_link[n]);
+        std::vector<uint32_t> next (network.first_link.begin(), network.first_link.end() - 1);
+        for (const Connection& c : connections) {
+            network.links[next[c.a]++] = {(uint16_t) c.b, c.kind, 0, c.ferry, c.bike_lanes};
+            network.links[next[c.b]++] = {(uint16_t) c.a, c.kind, 1, c.ferry, c.bike_lanes};
+        }
+        return network;
+    }
+    static Network load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) throw std::runtime_error("Could not open the network file " + path);
+        return parse(in, path);
+    }
+    /*
+        The places of model.h: Vancouver -- (ferry) -- Gibsons -- (bike path r or s) -- Roberts Creek -- (bike path s) -- Sechelt
+    */
+    static Network sunshineCoast() {
+        std::ostringstream text;
+        text.precision(17);
+        text << "location vancouver " << POPULATION_VANCOUVER << "\n"
+            << "location gibsons " << POPULATION_GIBSONS << "\n"
+            << "location roberts_creek " << POPULATION_ROBERTSCREEK << "\n"
+            << "location sechelt " << POPULATION_SECHELT << "\n"
+            << "ferry vancouver gibsons\n"
+            << "road gibsons roberts_creek bike_path=rs\n"
+            << "road roberts_creek sechelt bike_path=s\n";
+        std::istringstream in(text.str());
+        return parse(in, "the built-in network");
+    }
+
+private:
+    int find(const std::string& name) const {
+        for (std::size_t l (0); l < names.size(); ++l) if (names[l] == name) return (int) l;
+        return -1;
+    }
+
+    std::vector<std::string> names;
+    std::vector<double> populations;
+    std::vector<uint32_t> first_link; //locations() + 1 offsets into links
+    std::vector<Link> links;
+    std::vector<FerryRoute> ferries;
+};
+
+/*
+    Mode choice, worked out once per bike path. For every origin, destination and willingness to bike: whether the agent
+    bikes and which ferry queues they go through, in order. Everyone takes a route with the fewest links (the first one
+    found, going through the links in file order). Cars and die-hard cyclists can use every link; an agent who bikes if
+    there is a lane bikes when there is a route with at least one road on which every road has a lane under the
+    scenario's bike_path, and drives otherwise: a bike path is what makes them bike, so a ferry straight to the
+    destination does not. A route without ferries has no queues: the agent just goes. So has a destination that cannot
+    be reached at all, since nobody picks it (network_model.h).
+    The queues of (origin, destination, will_bike) are legs[first_leg[k]] .. legs[first_leg[k + 1] - 1] with
+    k = (origin * locations + destination) * 3 + will_bike, the same compressed layout as the graph.
+*/
+class RouteTable {
+public:
+    RouteTable(const Network& network, char bike_path) : n((int) network.locations()) {
+        uint32_t lane_bit = (bike_path >= 'a' && bike_path <= 'z') ? 1u << (bike_path - 'a') : 0;
+        first_leg.reserve((std::size_t) n * n * 3 + 1);
+        first_leg.push_back(0);
+        biking.reserve((std::size_t) n * n * 3);
+        std::vector<Step> by_car, by_lane; //from one origin, how the search got to each place
+        for (int origin (0); origin < n; ++origin) {
+            shortestRoutes(network, origin, 0, by_car);
+            shortestRoutes(network, origin, lane_bit, by_lane);
+            for (int destination (0); destination < n; ++destination) {
+                if (by_car[destination].from < 0) { //no way there at all, and so nobody going there
+                    for (int will_bike (0); will_bike < 3; ++will_bike) addNoRoute();
+                    continue;
+                }
+                bool lane = lane_bit != 0 && by_lane[destination].from >= 0 && hasRoad(origin, destination, by_lane);
+                addRoute(origin, destination, false, by_car); //NEVER_BIKES
+                addRoute(origin, destination, true, by_car); //ALWAYS_BIKES
+                addRoute(origin, destination, lane, lane ? by_lane : by_car); //BIKES_IF_PATH
+            }
+        }
+    }
+
+    const uint32_t* legsBegin(int origin, int destination, BikeType will_bike) const {
+        return legs.data() + first_leg[key(origin, destination, will_bike)];
+    }
+    const uint32_t* legsEnd(int origin, int destination, BikeType will_bike) const {
+        return legs.data() + first_leg[key(origin, destination, will_bike) + 1];
+    }
+    int legCount(int origin, int destination, BikeType will_bike) const {
+        std::size_t k = key(origin, destination, will_bike);
+        return (int) (first_leg[k + 1] - first_leg[k]);
+    }
+    bool bikes(int origin, int destination, BikeType will_bike) const {
+        return biking[key(origin, destination, will_bike)] != 0;
+    }
+
+private:
+    std::size_t key(int origin, int destination, BikeType will_bike) const {
+        return ((std::size_t) origin * n + destination) * 3 + will_bike;
+    }
+    struct Step {
+        int from; //the place before, -1 for places the search did not reach; the origin is its own
+        const Link* link; //from there to here
+    };
+    /*
+        Breadth-first search from origin. With lane_bit the roads without a lane under it are left out.
+    */
+    void shortestRoutes(const Network& network, int origin, uint32_t lane_bit, std::vector<Step>& came_by) const {
+        came_by.assign(n, Step {-1, nullptr});
+        came_by[origin].from = origin;
+        std::vector<uint16_t> frontier (1, (uint16_t) origin);
+        for (std::size_t i (0); i < frontier.size(); ++i) {
+            int l = frontier[i];
+            for (const Link* link = network.linksBegin(l); link != network.linksEnd(l); ++link) {
+                if (came_by[link->to].from >= 0) continue;
+                if (lane_bit != 0 && link->kind == LINK_ROAD && !(link->bike_lanes & lane_bit)) continue;
+                came_by[link->to] = {l, link};
+                frontier.push_back(link->to);
+            }
+        }
+    }
+    static bool hasRoad(int origin, int destination, const std::vector<Step>& came_by) {
+        for (int l (destination); l != origin; l = came_by[l].from) {
+            if (came_by[l].link->kind == LINK_ROAD) return true;
+        }
+        return false;
+    }
+    /*
+        Walk back from the destination to the origin, then put the ferries in the order they are taken
+    */
+    void addRoute(int origin, int destination, bool bike, const std::vector<Step>& came_by) {
+        std::size_t start = legs.size();
+        for (int l (destination); l != origin; l = came_by[l].from) {
+            const Link* link = came_by[l].link;
+            if (link->kind != LINK_FERRY) continue;
+            FerryQueue q = link->direction == 0 ? (bike ? QUEUE_BVG : QUEUE_CVG) : (bike ? QUEUE_BGV : QUEUE_CGV);
+            legs.push_back(link->ferry * N_QUEUES + q);
+        }
+        std::reverse(legs.begin() + start, legs.end());
+        first_leg.push_back((uint32_t) legs.size());
+        biking.push_back(bike);
+    }
+    void addNoRoute() {
+        first_leg.push_back((uint32_t) legs.size());
+        biking.push_back(0);
+    }
+
+    int n;
+    std::vector<uint32_t> first_leg;
+    std::vector<uint32_t> legs; //ferry * N_QUEUES + FerryQueue
+    std::vector<uint8_t> biking;
+};
+
+#endif // NETWORK_H
@@ -0,0 +1,251 @@
+#ifndef NETWORK_MODEL_H
+#define NETWORK_MODEL_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "model.h"
+#include "network.h"
+#include "events.h"
+#include "agents.h"
+#include "ferry_queue.h"
+#include "records.h"
+#include "instrument.h"
+/*
+    __NETWORK ENGINE__
+    The event-driven engine of events.h on a route network (network.h) instead of the four places of model.h.
+    - Every place gets ceil(population) agents who live there. An agent at home who starts a trip picks a destination
+      among the places across a ferry from home (on the way by car) in proportion to their populations. The model is
+      about the ferries, so trips that do not take one are left out: on the built-in network Vancouverites spread over
+      the coast with the weights of model.h and people from the coast always go to Vancouver, as in the other engines.
+    - The journey is the scenario's RouteTable entry for where they are, where they go and their willingness to bike:
+      one ferry queue after the other, joining the next one as soon as they get off the one before. Balking only
+      happens at the first queue; someone already on their way does not turn around halfway. A journey without a
+      ferry takes no time.
+    - Boarding is as in the other engines, sailing by sailing: sailing i of the day goes on every route that has at
+      least i + 1 sailings, each route boarding its own four queues in BOARDING_ORDER.
+    Agents are only touched on the days something happens to them, so the days cost in proportion to the trips, however
+    many places there are. What the routes and destinations cost is quadratic in the number of places, so they are
+    worked out once for a whole batch (NetworkRoutes) rather than in every iteration. An agent is three 16-bit location ids (home, where they are, where they
+    are going) and three bytes (willingness to bike, the next leg of the journey and the days of the trip).
+    The routing rules are the general ones of RouteTable, not the hand-written ones of chooseQueue, which are not the
+    same in both directions. On the built-in network (Network::sunshineCoast) they agree for the trips to and from
+    Sechelt and for most of the others. They differ for lane bikers between Vancouver and Roberts Creek under
+    bike_path = s, who bike both ways here but only towards Vancouver there, and for lane bikers between Vancouver and
+    Gibsons, who never bike here but there bike towards Vancouver (Gibsons residents always, visitors under r or s).
+    The draws are keyed like those of events.h: trip starts by (STREAM_TRIP_STARTS, k, day), the destination and the
+    length of the trip agent k starts on day t by (STREAM_TRIP_LENGTHS, k, t), the bike types by chunk (drawBikeTypes).
+    The bike types come from agent_rng, the iteration's stream, and everything else from rng, the scenario's, so the
+    agents are the same in every scenario of an iteration even without common random numbers (see runScenarios).
+*/
+
+/*
+    The network with what every iteration on it needs and no scenario changes: where the people of each place go, and a
+    RouteTable for each bike path, made the first time a scenario with that bike path asks for it. A destination has a
+    weight when it is across a ferry from home by car, so the only routes ever taken are between places that have a way
+    between them, both ways. One NetworkRoutes is shared by all the tasks of a batch; routes() can be called from any
+    thread.
+*/
+class NetworkRoutes {
+public:
+    explicit NetworkRoutes(Network graph) : places(std::move(graph)) {}
+
+    const Network& network() const {
+        return places;
+    }
+    const RouteTable& routes(char bike_path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<RouteTable>& table = tables[bike_path];
+        if (!table) table.reset(new RouteTable(places, bike_path));
+        if (destination_samplers.empty()) findDestinations(*table);
+        return *table;
+    }
+    /*
+        Where someone living at home goes; only valid for places that travels() and after the first routes()
+    */
+    const CategoricalSampler& destinations(int home) const {
+        return destination_samplers[home];
+    }
+    bool travels(int home) const {
+        return travelling[home] != 0;
+    }
+
+private:
+    void findDestinations(const RouteTable& table) {
+        int n_places = (int) places.locations();
+        travelling.assign(n_places, 0);
+        for (int l (0); l < n_places; ++l) {
+            std::vector<double> weights (n_places);
+            double total = 0.0;
+            for (int d (0); d < n_places; ++d) {
+                total += weights[d] = table.legCount(l, d, NEVER_BIKES) > 0 ? places.population(d) : 0.0;
+            }
+            travelling[l] = total > 0.0;
+            if (!travelling[l]) weights[l] = 1.0; //never used, but keeps the sampler well defined
+            destination_samplers.push_back(CategoricalSampler(weights));
+        }
+    }
+
+    Network places;
+    std::mutex mutex;
+    std::map<char, std::unique_ptr<RouteTable>> tables; //by bike path
+    std::vector<CategoricalSampler> destination_samplers; //by home
+    std::vector<char> travelling; //false if there is nobody across a ferry to visit
+};
+
+class NetworkModel {
+public:
+    NetworkModel(NetworkRoutes& shared, const Scenario& parameters, int t_max, const RandomStream& agent_rng, const RandomStream& rng)
+        : network(shared.network()), scenario(parameters), routes(shared.routes(parameters.bike_path)), shared(shared),
+          calendar(t_max), randomizer(rng), trip_length(n_days), ferry_queues(network.ferryRoutes() * N_QUEUES),
+          boarded(network.ferryRoutes() * N_QUEUES, 0), balked(network.ferryRoutes() * N_QUEUES, 0) {
+        double p_nonzero = 1.0 - std::exp(-trip_length.mean());
+        p_start_peak = takes_trip_peak.p() * p_nonzero;
+        p_start_nonpeak = takes_trip_nonpeak.p() * p_nonzero;
+        int n_places = (int) network.locations();
+        for (int l (0); l < n_places; ++l) home.resize(home.size() + (std::size_t) std::ceil(network.population(l)), (uint16_t) l);
+        location = home;
+        target = home;
+        will_bike.resize(home.size());
+        leg.assign(home.size(), 0);
+        trip_days.assign(home.size(), 0);
+        drawBikeTypes(home.size(), scenario.p_bike_if_lane, scenario.p_always_bike, agent_rng, [&](std::size_t i, BikeType type) {
+            will_bike[i] = type;
+        });
+        for (std::size_t i (0); i < home.size(); ++i) {
+            if (shared.travels(home[i])) calendar.schedule(nextTripStart((uint32_t) i, 0), (uint32_t) i);
+        }
+    }
+
+    /*
+        One day; with a recorder every sailing is also recorded (see records.h)
+    */
+    void step(int t, SailingRecorder* recorder = nullptr) {
+        {
+            ScopedTimer timer(PHASE_ROUTING); //the destinations and lengths of the trips are drawn in here too
+            std::vector<uint32_t>& today = calendar.bucket(t);
+            std::sort(today.begin(), today.end()); //index order, like the other engines
+            int64_t returns = 0, balked_today = 0;
+            for (uint32_t k : today) {
+                bool returning = location[k] != home[k];
+                if (returning) target[k] = home[k];
+                else {
+                    RandomStream trip_randomizer = randomizer.substream(STREAM_TRIP_LENGTHS, k, t);
+                    target[k] = (uint16_t) shared.destinations(home[k])(trip_randomizer());
+                    int days;
+                    do days = trip_length(trip_randomizer); while (days == 0); //we already know the trip is at least one day long
+                    trip_days[k] = (uint8_t) std::min(days, (int) Population::MAX_TRIP_DAYS);
+                }
+                returns += returning;
+                leg[k] = 0;
+                const uint32_t* legs = routes.legsBegin(location[k], target[k], (BikeType) will_bike[k]);
+                if (legs == routes.legsEnd(location[k], target[k], (BikeType) will_bike[k])) { //no ferry on the way
+                    arrive(k, t);
+                    continue;
+                }
+                uint32_t q = legs[0];
+                if (balks(ferry_queues[q].size(), scenario)) {
+                    ++balked[q];
+                    ++balked_today;
+                    target[k] = location[k];
+                    calendar.schedule(returning ? t + 1 : nextTripStart(k, t + 1), k);
+                    continue;
+                }
+                ferry_queues[q].push_back(k);
+            }
+            count(COUNT_TRIPS_STARTED, (int64_t) today.size() - returns);
+            count(COUNT_RETURNS, returns);
+            count(COUNT_BALKS, balked_today);
+            for (std::size_t q (0); q < ferry_queues.size(); ++q) {
+                recordQueueLength((FerryQueue) (q % N_QUEUES), (int64_t) ferry_queues[q].size());
+            }
+            std::vector<uint32_t>().swap(today); //done with this day, free the memory
+        }
+        ScopedTimer timer(PHASE_BOARDING);
+        int64_t boarded_today = 0;
+        int most_sailings = 0;
+        for (std::size_t f (0); f < network.ferryRoutes(); ++f) most_sailings = std::max(most_sailings, network.sailingsPerDay((int) f, scenario));
+        for (int i (0); i < most_sailings; ++i) {
+            for (int f (0); f < (int) network.ferryRoutes(); ++f) {
+                if (i >= network.sailingsPerDay(f, scenario)) continue;
+                for (FerryQueue kind : BOARDING_ORDER) {
+                    uint32_t q = f * N_QUEUES + kind;
+                    int passengers = boardFerry(q, network.capacity(f, kind, scenario), t);
+                    boarded[q] += passengers;
+                    boarded_today += passengers;
+                    if (recorder) recorder->sailed(t, i, kind, passengers, (int64_t) ferry_queues[q].size(), balked[q], f);
+                }
+            }
+        }
+        count(COUNT_BOARDED, boarded_today);
+    }
+
+    /*
+        Cumulative number of agents carried by each queue of a ferry route, by default the first one in the network
+    */
+    int64_t tripsBoarded(FerryQueue q, int ferry = 0) const {
+        return boarded[ferry * N_QUEUES + q];
+    }
+    int64_t queueLength(FerryQueue q, int ferry = 0) const {
+        return (int64_t) ferry_queues[ferry * N_QUEUES + q].size();
+    }
+    int64_t tripsBalked(FerryQueue q, int ferry = 0) const {
+        return balked[ferry * N_QUEUES + q];
+    }
+
+private:
+    int nextTripStart(uint32_t k, int day) const {
+        return ::nextTripStart(randomizer, k, day, calendar.horizon(), p_start_peak, p_start_nonpeak);
+    }
+    /*
+        Agent k gets where they were going on day t. At their destination they count down their trip on days t + 1
+        to t + days and start back the day after; at home they can start their next trip tomorrow.
+    */
+    void arrive(uint32_t k, int t) {
+        location[k] = target[k];
+        if (location[k] != home[k]) calendar.schedule(t + trip_days[k] + 1, k);
+        else calendar.schedule(nextTripStart(k, t + 1), k);
+    }
+    /*
+        Passengers with another ferry ahead of them join its queue right away; a shortest route never takes the same
+        ferry twice, so that is never the queue being boarded
+    */
+    int boardFerry(uint32_t q, int capacity, int t) {
+        return (int) ferry_queues[q].popFront(capacity, [&](const uint32_t* agents, std::size_t n) {
+            for (std::size_t m (0); m < n; ++m) {
+                uint32_t k = agents[m];
+                int next = ++leg[k];
+                if (next < routes.legCount(location[k], target[k], (BikeType) will_bike[k])) {
+                    ferry_queues[routes.legsBegin(location[k], target[k], (BikeType) will_bike[k])[next]].push_back(k);
+                }
+                else arrive(k, t);
+            }
+        });
+    }
+
+    const Network& network;
+    Scenario scenario;
+    const RouteTable& routes;
+    const NetworkRoutes& shared; //for the destinations
+    Calendar calendar;
+    RandomStream randomizer;
+    std::poisson_distribution<> trip_length;
+    std::vector<uint16_t> home;
+    std::vector<uint16_t> location; //where the agent is, until they get off the last ferry of a journey
+    std::vector<uint16_t> target; //where they are going, or where they are when they are not going anywhere
+    std::vector<uint8_t> will_bike; //a BikeType
+    std::vector<uint8_t> leg; //which ferry of the journey they are queueing for
+    std::vector<uint8_t> trip_days;
+    std::vector<PassengerQueue> ferry_queues; //ferry * N_QUEUES + FerryQueue
+    std::vector<int64_t> boarded;
+    std::vector<int64_t> balked;
+    double p_start_peak;
+    double p_start_nonpeak;
+};
+
+#endif // NETWORK_MODEL_H
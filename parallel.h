@@ -0,0 +1,160 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+/*
+    A minimal thread pool: n_threads workers take task numbers 0 .. n_tasks - 1 off a shared counter until they run
+    out. Tasks must not depend on each other or on the order they run in. If a task throws, the remaining tasks are
+    skipped and the first exception is rethrown on the calling thread.
+    runInParallel starts the workers and joins them again, which is fine for a few big jobs; ThreadPool keeps its
+    workers for the next call, for jobs that come every simulated day.
+*/
+inline int defaultThreadCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : (int) n;
+}
+
+template <class Task>
+void runInParallel(int n_tasks, int n_threads, Task task) {
+    std::atomic<int> next (0);
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+    auto worker = [&]() {
+        for (int i = next++; i < n_tasks; i = next++) {
+            try {
+                task(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(failure_mutex);
+                if (!failure) failure = std::current_exception();
+                next = n_tasks;
+            }
+        }
+    };
+    if (n_threads > n_tasks) n_threads = n_tasks;
+    std::vector<std::thread> pool;
+    for (int i (1); i < n_threads; ++i) pool.emplace_back(worker);
+    worker(); //the calling thread works too
+    for (std::thread& thread : pool) thread.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+/*
+    n_threads - 1 workers that wait between calls to run(); the calling thread is the last one. Copying a pool gives a
+    new pool with as many threads, so a model that owns one can be copied (see AgentModel in agents.h). One run() at a
+    time per pool.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(int n_threads) : state(new State) {
+        for (int i (1); i < n_threads; ++i) state->workers.emplace_back(&ThreadPool::work, state.get());
+    }
+    ThreadPool(const ThreadPool& other) : ThreadPool(other.size()) {}
+    ThreadPool(ThreadPool&& other) noexcept = default;
+    ThreadPool& operator=(ThreadPool other) noexcept {
+        stop();
+        state = std::move(other.state);
+        return *this;
+    }
+    ~ThreadPool() {
+        stop();
+    }
+    int size() const {
+        return state ? (int) state->workers.size() + 1 : 1;
+    }
+
+    template <class Task>
+    void run(int n_tasks, Task task) {
+        State& s = *state;
+        if (s.workers.empty() || n_tasks <= 1) {
+            for (int i (0); i < n_tasks; ++i) task(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.task = &task;
+            s.call = [](void* t, int i) {
+                (*static_cast<Task*>(t))(i);
+            };
+            s.n_tasks = n_tasks;
+            s.next = 0;
+            s.failure = nullptr;
+            s.busy = (int) s.workers.size();
+            ++s.generation;
+        }
+        s.wake.notify_all();
+        s.drain();
+        std::unique_lock<std::mutex> lock(s.mutex);
+        s.done.wait(lock, [&]() {
+            return s.busy == 0;
+        });
+        if (s.failure) std::rethrow_exception(s.failure);
+    }
+
+private:
+    struct State {
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake; //a new job, or stop
+        std::condition_variable done; //the last worker finished the job
+        uint64_t generation = 0; //jobs so far
+        bool stopping = false;
+        void* task = nullptr;
+        void (*call)(void*, int) = nullptr;
+        int n_tasks = 0;
+        std::atomic<int> next {0};
+        int busy = 0; //workers still on the current job
+        std::exception_ptr failure;
+
+        void drain() {
+            for (int i = next++; i < n_tasks; i = next++) {
+                try {
+                    call(task, i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!failure) failure = std::current_exception();
+                    next = n_tasks;
+                }
+            }
+        }
+    };
+
+    static void work(State* s) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(s->mutex);
+                s->wake.wait(lock, [&]() {
+                    return s->stopping || s->generation != seen;
+                });
+                if (s->stopping) return;
+                seen = s->generation;
+            }
+            s->drain();
+            std::lock_guard<std::mutex> lock(s->mutex);
+            if (--s->busy == 0) s->done.notify_one();
+        }
+    }
+    void stop() {
+        if (!state) return;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->stopping = true;
+        }
+        state->wake.notify_all();
+        for (std::thread& thread : state->workers) thread.join();
+        state.reset();
+    }
+
+    std::unique_ptr<State> state;
+};
+
+#endif // PARALLEL_H
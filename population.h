@@ -0,0 +1,179 @@
+#ifndef POPULATION_H
+#define POPULATION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+/*
+    Packed storage for the agents in the model.
+    The old vector<Agent> used three chars per agent, and we kept trip_lengths (int) and destinations (char) in separate
+    vectors next to it, so every daily pass streamed about 10 bytes per agent through memory. Here an agent is exactly
+    two bytes, stored as two parallel arrays so that a scan over one attribute is contiguous:
+
+        places[i]    = home | location << 2 | will_bike << 4 | destination << 6  (two bits each)
+        trip_days[i] = queued << 7 | days left in the trip                       (seven bits of days)
+
+    "queued" means the agent is standing in a ferry queue, either on the way out or on the way home. While queued the
+    agent does not draw a new trip and does not count down their vacation, which also stops them from being pushed
+    into the queue a second time.
+*/
+
+enum Place : uint8_t {
+    VANCOUVER = 0,
+    GIBSONS = 1,
+    ROBERTS_CREEK = 2,
+    SECHELT = 3
+};
+
+enum BikeType : uint8_t {
+    NEVER_BIKES = 0, //'n'
+    ALWAYS_BIKES = 1, //'y'
+    BIKES_IF_PATH = 2 //'p', only if there is a path
+};
+
+/*
+    Conversions to and from the one-letter codes used in the input prompts and the header comment
+*/
+constexpr char placeToChar(Place p) {
+    return "vgrs"[p];
+}
+inline Place charToPlace(char c) {
+    switch (c) {
+        case 'v': return VANCOUVER;
+        case 'g': return GIBSONS;
+        case 'r': return ROBERTS_CREEK;
+        case 's': return SECHELT;
+    }
+    throw std::runtime_error("Unknown location code");
+}
+inline char bikeToChar(BikeType b) {
+    return "nyp"[b];
+}
+inline BikeType charToBike(char c) {
+    switch (c) {
+        case 'n': return NEVER_BIKES;
+        case 'y': return ALWAYS_BIKES;
+        case 'p': return BIKES_IF_PATH;
+    }
+    throw std::runtime_error("Unknown bike willingness code");
+}
+
+class Population {
+public:
+    static const int MAX_TRIP_DAYS = 127; //seven bits, a Poisson(3.3) trip is never anywhere near this long
+
+    std::size_t size() const {
+        return places.size();
+    }
+    void reserve(std::size_t n) {
+        places.reserve(n);
+        trip_days.reserve(n);
+    }
+    /*
+        Replace everything with n agents copied from two packed arrays, e.g. from a snapshot (snapshot.h)
+    */
+    void assign(const uint8_t* packed_places, const uint8_t* packed_trip_days, std::size_t n) {
+        places.assign(packed_places, packed_places + n);
+        trip_days.assign(packed_trip_days, packed_trip_days + n);
+    }
+    void push_back(Place home, Place location, BikeType will_bike) {
+        places.push_back(pack(home, location, will_bike, home));
+        trip_days.push_back(0);
+    }
+    /*
+        n agents at home in home, all at once
+    */
+    void append(Place home, BikeType will_bike, std::size_t n) {
+        places.resize(places.size() + n, pack(home, home, will_bike, home));
+        trip_days.resize(trip_days.size() + n, 0);
+    }
+
+    Place getHome(std::size_t i) const {
+        return static_cast<Place>(places[i] & 3);
+    }
+    Place getLocation(std::size_t i) const {
+        return static_cast<Place>((places[i] >> 2) & 3);
+    }
+    void setLocation(std::size_t i, Place new_location) {
+        places[i] = (places[i] & ~(3 << 2)) | (new_location << 2);
+    }
+    BikeType willBike(std::size_t i) const {
+        return static_cast<BikeType>((places[i] >> 4) & 3);
+    }
+    void setBike(std::size_t i, BikeType new_willingness) {
+        places[i] = (places[i] & ~(3 << 4)) | (new_willingness << 4);
+    }
+    Place getDestination(std::size_t i) const {
+        return static_cast<Place>(places[i] >> 6);
+    }
+    void setDestination(std::size_t i, Place new_destination) {
+        places[i] = (places[i] & ~(3 << 6)) | (new_destination << 6);
+    }
+    bool isOnVacation(std::size_t i) const {
+        return ((places[i] ^ (places[i] >> 2)) & 3) != 0; //home bits differ from location bits
+    }
+
+    int getTripDays(std::size_t i) const {
+        return trip_days[i] & MAX_TRIP_DAYS;
+    }
+    void setTripDays(std::size_t i, int days) {
+        if (days > MAX_TRIP_DAYS) days = MAX_TRIP_DAYS;
+        trip_days[i] = (trip_days[i] & QUEUED) | days;
+    }
+    void countDownTrip(std::size_t i) {
+        --trip_days[i]; //only called when the days bits are non-zero, so this never touches the queued bit
+    }
+    bool isQueued(std::size_t i) const {
+        return (trip_days[i] & QUEUED) != 0;
+    }
+    void setQueued(std::size_t i) {
+        trip_days[i] |= QUEUED;
+    }
+    /*
+        Take agent i off the ferry on the other side. If they were at home they arrive at their destination, otherwise
+        they are coming back from vacation and arrive home.
+    */
+    void board(std::size_t i) {
+        uint8_t a = places[i];
+        uint8_t home = a & 3;
+        uint8_t location = (a >> 2) & 3;
+        uint8_t arrival = (home == location) ? (a >> 6) : home;
+        places[i] = (a & ~(3 << 2)) | (arrival << 2);
+        trip_days[i] &= MAX_TRIP_DAYS;
+    }
+
+    /*
+        The same for a whole span of agents that got on one ferry
+    */
+    void boardAll(const uint32_t* agents, std::size_t n) {
+        for (std::size_t m (0); m < n; ++m) board(agents[m]);
+    }
+    /*
+        Agent i found the queue too long and did not join it after all (see balks() in model.h). If they were leaving
+        home the trip is off; if they were coming back they are still away with no days left, so they try again tomorrow.
+    */
+    void balk(std::size_t i) {
+        trip_days[i] = 0;
+    }
+
+    /*
+        Raw access to the packed arrays, for loops that want to scan them directly
+    */
+    static constexpr uint8_t pack(Place home, Place location, BikeType will_bike, Place destination) {
+        return home | (location << 2) | (will_bike << 4) | (destination << 6);
+    }
+    const uint8_t* placeData() const {
+        return places.data();
+    }
+    const uint8_t* tripData() const {
+        return trip_days.data();
+    }
+
+private:
+    static const uint8_t QUEUED = 0x80;
+    std::vector<uint8_t> places;
+    std::vector<uint8_t> trip_days;
+};
+
+#endif // POPULATION_H
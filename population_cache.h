@@ -0,0 +1,127 @@
+#ifndef POPULATION_CACHE_H
+#define POPULATION_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "population.h"
+#include "model.h"
+#include "rng.h"
+#include "mapped_file.h"
+/*
+    __POPULATION CACHE__
+    The agents of an iteration, after assignBikers, only depend on the populations of the four areas, MODEL_SCALE,
+    p_bike_if_lane, p_always_bike, the master seed, the iteration and whether it is an antithetic twin. With population_cache = DIR in a batch they are
+    saved in DIR the first time they are built, and every later scenario or run with the same key maps the file and
+    copies the two packed arrays in instead of building them. The file is
+
+        PopulationFileHeader (magic "FERRYPOP", version and the whole key), places[n_agents], trip_days[n_agents]
+
+    in the byte order of the machine that wrote it. The file name is a hash of the key; the header holds the key itself,
+    so a file is only used if everything matches.
+*/
+
+const char POPULATION_MAGIC[8] = {'F', 'E', 'R', 'R', 'Y', 'P', 'O', 'P'};
+const uint32_t POPULATION_VERSION (2); //2: the key has the antithetic flag
+
+struct PopulationKey {
+    uint64_t seed;
+    uint32_t iteration;
+    float p_bike_if_lane;
+    float p_always_bike;
+    bool antithetic;
+};
+
+struct PopulationFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t iteration;
+    uint64_t seed;
+    float p_bike_if_lane;
+    float p_always_bike;
+    uint32_t antithetic;
+    uint32_t padding;
+    double populations[4]; //Vancouver, Sechelt, Gibsons, Roberts Creek, the order buildBasePopulation adds them in
+    double model_scale;
+    uint64_t n_agents;
+};
+
+inline PopulationFileHeader populationFileHeader(const PopulationKey& key) {
+    PopulationFileHeader header;
+    std::memset(&header, 0, sizeof header);
+    std::memcpy(header.magic, POPULATION_MAGIC, sizeof header.magic);
+    header.version = POPULATION_VERSION;
+    header.iteration = key.iteration;
+    header.seed = key.seed;
+    header.p_bike_if_lane = key.p_bike_if_lane;
+    header.p_always_bike = key.p_always_bike;
+    header.antithetic = key.antithetic;
+    header.populations[0] = POPULATION_VANCOUVER;
+    header.populations[1] = POPULATION_SECHELT;
+    header.populations[2] = POPULATION_GIBSONS;
+    header.populations[3] = POPULATION_ROBERTSCREEK;
+    header.model_scale = MODEL_SCALE;
+    return header;
+}
+
+inline std::string populationCachePath(const std::string& dir, const PopulationKey& key) {
+    PopulationFileHeader header = populationFileHeader(key);
+    uint32_t lane, always;
+    uint64_t scale;
+    std::memcpy(&lane, &header.p_bike_if_lane, sizeof lane);
+    std::memcpy(&always, &header.p_always_bike, sizeof always);
+    std::memcpy(&scale, &header.model_scale, sizeof scale);
+    uint64_t hash = streamId(streamId(key.seed, key.iteration, (uint64_t) lane << 32 | always), scale, key.antithetic);
+    for (double people : header.populations) {
+        uint64_t bits;
+        std::memcpy(&bits, &people, sizeof bits);
+        hash = streamId(hash, bits);
+    }
+    char name[32];
+    std::snprintf(name, sizeof name, "population_%016llx.pop", (unsigned long long) hash);
+    return dir + "/" + name;
+}
+
+/*
+    Load the population saved under key at path. False if there is no such file or it was saved under another key.
+*/
+inline bool loadCachedPopulation(const std::string& path, const PopulationKey& key, Population& world) {
+    if (!std::ifstream(path)) return false;
+    MappedFile file(path);
+    PopulationFileHeader wanted = populationFileHeader(key);
+    if (file.size() < sizeof wanted) return false;
+    PopulationFileHeader found;
+    std::memcpy(&found, file.data(), sizeof found);
+    wanted.n_agents = found.n_agents;
+    if (std::memcmp(&found, &wanted, sizeof found) != 0) return false;
+    if (file.size() != sizeof found + 2 * found.n_agents) return false; //cut short
+    const uint8_t* arrays = (const uint8_t*) file.data() + sizeof found;
+    world.assign(arrays, arrays + found.n_agents, found.n_agents);
+    return true;
+}
+
+/*
+    Save world under key at path. Several threads can save the same population at once: each writes its own temporary
+    file and renames it, and the last rename wins with identical contents.
+*/
+inline void saveCachedPopulation(const std::string& path, const PopulationKey& key, const Population& world) {
+    PopulationFileHeader header = populationFileHeader(key);
+    header.n_agents = world.size();
+    std::string partial = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream out(partial, std::ios::binary);
+        if (!out) throw std::runtime_error("Could not open the population file " + partial);
+        out.write((const char*) &header, sizeof header);
+        out.write((const char*) world.placeData(), world.size());
+        out.write((const char*) world.tripData(), world.size());
+        if (!out) throw std::runtime_error("Writing the population file " + partial + " failed");
+    }
+    if (std::rename(partial.c_str(), path.c_str()) != 0) throw std::runtime_error("Could not rename " + partial + " to " + path);
+}
+
+#endif // POPULATION_CACHE_H
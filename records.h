@@ -0,0 +1,251 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "model.h"
+#include "instrument.h"
+/*
+    __SAILING RECORDS__
+    Step 4 of the algorithm asks for the length of the ferry queues as well as the passengers. With records switched on
+    (records = FILE in a batch) every sailing of every queue becomes one record:
+
+        scenario, iteration, day, sailing, route, direction, mode, boarded, queue length left behind, balked
+
+    direction is 0 to the coast and 1 to Vancouver, mode is 0 for cars and 1 for bikes, sailing counts the sailings of
+    the day from 0 and balked is the number of agents who walked away from that queue since its previous sailing.
+    route is the ferry route, always 0 except with a route network (network.h), where "to the coast" means from the
+    first terminal of the route to the second.
+    The records are streamed to a binary file while the model runs, so nothing has to be kept in memory until the end.
+    Each iteration collects its records in a RecordBlock, one array per column, and hands full blocks to the
+    RecordWriter, which writes them from a background thread. The file is
+
+        "FERRYREC" (8 bytes), format version (uint32), then blocks of: record count n (uint32) followed by the columns
+        in the order above, n values each, as uint32, uint32, uint16, uint16, uint16, uint8, uint8, uint32, uint32, uint32
+
+    in the byte order of the machine that wrote it. Blocks of different iterations can come in any order, but within
+    an iteration the records are in the order of the sailings. --export FILE turns a record file into CSV.
+*/
+
+const char RECORD_MAGIC[8] = {'F', 'E', 'R', 'R', 'Y', 'R', 'E', 'C'};
+const uint32_t RECORD_VERSION (2); //2: the route column
+
+struct RecordBlock {
+    static const std::size_t CAPACITY = 1 << 14; //records per block, about 400 kB
+
+    std::vector<uint32_t> scenario;
+    std::vector<uint32_t> iteration;
+    std::vector<uint16_t> day;
+    std::vector<uint16_t> sailing;
+    std::vector<uint16_t> route;
+    std::vector<uint8_t> direction;
+    std::vector<uint8_t> mode;
+    std::vector<uint32_t> boarded;
+    std::vector<uint32_t> queue_left;
+    std::vector<uint32_t> balked;
+
+    std::size_t size() const {
+        return scenario.size();
+    }
+    void push_back(int s, int n, int t, int i, int f, FerryQueue q, int64_t passengers, int64_t left, int64_t walked_away) {
+        scenario.push_back((uint32_t) s);
+        iteration.push_back((uint32_t) n);
+        day.push_back((uint16_t) t);
+        sailing.push_back((uint16_t) i);
+        route.push_back((uint16_t) f);
+        direction.push_back(isToCoast(q) ? 0 : 1);
+        mode.push_back(isBikeQueue(q) ? 1 : 0);
+        boarded.push_back((uint32_t) passengers);
+        queue_left.push_back((uint32_t) left);
+        balked.push_back((uint32_t) walked_away);
+    }
+    void clear() {
+        *this = RecordBlock();
+    }
+
+    void write(std::ostream& out) const {
+        uint32_t n = (uint32_t) size();
+        out.write((const char*) &n, sizeof n);
+        writeColumn(out, scenario);
+        writeColumn(out, iteration);
+        writeColumn(out, day);
+        writeColumn(out, sailing);
+        writeColumn(out, route);
+        writeColumn(out, direction);
+        writeColumn(out, mode);
+        writeColumn(out, boarded);
+        writeColumn(out, queue_left);
+        writeColumn(out, balked);
+    }
+    /*
+        Read the next block, false at the end of the file
+    */
+    bool read(std::istream& in) {
+        uint32_t n;
+        if (!in.read((char*) &n, sizeof n)) return false;
+        readColumn(in, scenario, n);
+        readColumn(in, iteration, n);
+        readColumn(in, day, n);
+        readColumn(in, sailing, n);
+        readColumn(in, route, n);
+        readColumn(in, direction, n);
+        readColumn(in, mode, n);
+        readColumn(in, boarded, n);
+        readColumn(in, queue_left, n);
+        readColumn(in, balked, n);
+        if (!in) throw std::runtime_error("The record file ends in the middle of a block");
+        return true;
+    }
+
+private:
+    template <class T>
+    static void writeColumn(std::ostream& out, const std::vector<T>& column) {
+        out.write((const char*) column.data(), column.size() * sizeof(T));
+    }
+    template <class T>
+    static void readColumn(std::istream& in, std::vector<T>& column, uint32_t n) {
+        column.resize(n);
+        in.read((char*) column.data(), n * sizeof(T));
+    }
+};
+
+/*
+    Writes blocks to a record file from its own thread. submit() only waits if the writer has fallen a few blocks
+    behind, which keeps the memory bounded when the disk is slower than the model.
+*/
+class RecordWriter {
+public:
+    explicit RecordWriter(const std::string& path) : out(path, std::ios::binary) {
+        if (!out) throw std::runtime_error("Could not open the record file " + path);
+        out.write(RECORD_MAGIC, sizeof RECORD_MAGIC);
+        out.write((const char*) &RECORD_VERSION, sizeof RECORD_VERSION);
+        worker = std::thread([this]() {
+            writeLoop();
+        });
+    }
+    ~RecordWriter() {
+        try {
+            close();
+        }
+        catch (...) {} //nothing sensible to do about a failed write here, close() reports it when called directly
+    }
+
+    void submit(RecordBlock&& block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [this]() {
+            return pending.size() < MAX_PENDING;
+        });
+        pending.push_back(std::move(block));
+        work.notify_one();
+    }
+    /*
+        Write everything that is still pending and close the file
+    */
+    void close() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        work.notify_one();
+        worker.join();
+        out.close();
+        if (failed || !out) throw std::runtime_error("Writing the record file failed");
+    }
+
+private:
+    static const std::size_t MAX_PENDING = 8;
+
+    void writeLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work.wait(lock, [this]() {
+                return done || !pending.empty();
+            });
+            if (pending.empty()) return; //done and nothing left
+            RecordBlock block = std::move(pending.front());
+            pending.pop_front();
+            room.notify_one();
+            lock.unlock();
+            {
+                ScopedTimer timer(PHASE_OUTPUT);
+                block.write(out);
+            }
+            if (!out) failed = true;
+            lock.lock();
+        }
+    }
+
+    std::ofstream out;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable work; //a block is pending or we are done
+    std::condition_variable room; //a pending block was taken
+    std::deque<RecordBlock> pending;
+    bool done = false;
+    bool failed = false;
+};
+
+/*
+    The records of one iteration of one scenario. The engines call sailed() after every sailing with the cumulative
+    number of agents who balked at that queue, and the recorder turns that into the balks since the previous sailing.
+*/
+class SailingRecorder {
+public:
+    SailingRecorder(RecordWriter& records, int s, int n) : writer(records), scenario(s), iteration(n) {}
+    ~SailingRecorder() {
+        if (block.size() > 0) writer.submit(std::move(block));
+    }
+
+    void sailed(int day, int sailing, FerryQueue q, int64_t boarded, int64_t queue_left, int64_t balked_total, int ferry = 0) {
+        std::size_t queue = (std::size_t) ferry * N_QUEUES + q;
+        if (queue >= balked_before.size()) balked_before.resize(queue + 1, 0);
+        block.push_back(scenario, iteration, day, sailing, ferry, q, boarded, queue_left, balked_total - balked_before[queue]);
+        balked_before[queue] = balked_total;
+        if (block.size() == RecordBlock::CAPACITY) {
+            writer.submit(std::move(block));
+            block.clear();
+        }
+    }
+
+private:
+    RecordWriter& writer;
+    int scenario;
+    int iteration;
+    std::vector<int64_t> balked_before; //by ferry * N_QUEUES + queue
+    RecordBlock block;
+};
+
+/*
+    Write a record file as CSV, one row per record
+*/
+inline void exportRecords(const std::string& path, std::ostream& csv) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open the record file " + path);
+    char magic[sizeof RECORD_MAGIC];
+    uint32_t version = 0;
+    in.read(magic, sizeof magic);
+    in.read((char*) &version, sizeof version);
+    if (!in || std::memcmp(magic, RECORD_MAGIC, sizeof magic) != 0) throw std::runtime_error(path + " is not a record file");
+    if (version != RECORD_VERSION) throw std::runtime_error(path + " has record format version " + std::to_string(version));
+    csv << "Scenario,Iteration,Day,Sailing,Route,Direction,Mode,Boarded,Queue Left,Balked\n";
+    RecordBlock block;
+    while (block.read(in)) {
+        for (std::size_t r (0); r < block.size(); ++r) {
+            csv << block.scenario[r] << "," << block.iteration[r] << "," << block.day[r] << "," << block.sailing[r] << ","
+                << block.route[r] << "," << (block.direction[r] == 0 ? "to coast" : "to vancouver") << "," << (block.mode[r] == 0 ? "car" : "bike") << ","
+                << block.boarded[r] << "," << block.queue_left[r] << "," << block.balked[r] << "\n";
+        }
+    }
+}
+
+#endif // RECORDS_H
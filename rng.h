@@ -0,0 +1,298 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RNG_HAVE_AVX2 //the compiler can build an AVX2 version of philoxBlocks next to the plain one
+#include <immintrin.h>
+#endif
+inline void philoxBlocks(const uint32_t key[2], const uint32_t counter[4], std::size_t n_blocks, uint32_t* out);
+
+/*
+    Counter-based random numbers. A RandomStream is the Philox4x32-10 generator of Salmon et al. (2011): the n-th
+    block of output is a fixed scrambling function of (key, n), so there is no hidden state to share between threads
+    and any number of independent streams can be made by giving them different keys. We key every stream with the
+    master seed and a stream id (for example the iteration number), which makes the results of an iteration depend
+    only on the seed and the iteration, never on which thread ran it or in which order.
+    It satisfies UniformRandomBitGenerator, so it plugs into the std:: distributions like std::mt19937 does. For bulk
+    use, fill() writes the next n outputs to an array several blocks at a time (with AVX2 where the CPU has it), and
+    gives exactly the numbers that n calls would have, and at(n) reads any one output without going through the ones
+    before it.
+    antithetic() is the same stream with every output x replaced by 2^32 - 1 - x, i.e. every uniform u by 1 - u. A run
+    and its antithetic twin have the same distribution but tend to err in opposite directions, so their average is
+    less noisy than two independent runs (see runScenarios in main.cpp).
+*/
+class RandomStream {
+public:
+    typedef uint32_t result_type;
+
+    RandomStream(uint64_t seed, uint64_t stream) {
+        key[0] = (uint32_t) seed;
+        key[1] = (uint32_t) (seed >> 32);
+        counter[0] = 0;
+        counter[1] = 0;
+        counter[2] = (uint32_t) stream;
+        counter[3] = (uint32_t) (stream >> 32);
+        index = 4; //nothing generated yet
+        mirrored = 0;
+    }
+
+    /*
+        An independent stream derived from this one, e.g. substream(STREAM_SWEEP, day, chunk) for the random numbers of
+        one chunk of agents on one day. Only the stream id is used, not how far this stream has got.
+    */
+    RandomStream substream(uint64_t purpose, uint64_t a, uint64_t b = 0) const;
+    /*
+        The antithetic twin of this stream, and of every substream made from it
+    */
+    RandomStream antithetic() const {
+        RandomStream twin = *this;
+        twin.mirrored = ~mirrored;
+        for (uint32_t& word : twin.output) word = ~word;
+        return twin;
+    }
+    bool isAntithetic() const {
+        return mirrored != 0;
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+    result_type operator()() {
+        if (index == 4) {
+            generateBlock();
+            index = 0;
+        }
+        return output[index++];
+    }
+    void fill(uint32_t* out, std::size_t n) {
+        std::size_t i = 0;
+        while (i < n && index < 4) out[i++] = output[index++]; //what is left of the current block
+        std::size_t blocks = (n - i) / 4;
+        if (blocks > 0) {
+            philoxBlocks(key, counter, blocks, out + i);
+            if (mirrored) for (std::size_t j (i); j < i + 4 * blocks; ++j) out[j] = ~out[j];
+            uint64_t block = ((uint64_t) counter[1] << 32 | counter[0]) + blocks;
+            counter[0] = (uint32_t) block;
+            counter[1] = (uint32_t) (block >> 32);
+            i += 4 * blocks;
+        }
+        while (i < n) out[i++] = (*this)();
+    }
+    /*
+        Output n of the stream, counting from where it started; it does not matter how far the stream has got. For
+        draws that belong to one agent, like the length of a trip, so they do not depend on the draws of the others.
+    */
+    result_type at(uint64_t n) const {
+        uint32_t c[4] = {(uint32_t) (n / 4), (uint32_t) (n / 4 >> 32), counter[2], counter[3]};
+        uint32_t out[4];
+        block(key, c, out);
+        return out[n % 4] ^ mirrored;
+    }
+    void discard(unsigned long long z) {
+        while (z > 0 && index < 4) {
+            ++index;
+            --z;
+        }
+        uint64_t blocks = z / 4;
+        uint64_t block = ((uint64_t) counter[1] << 32 | counter[0]) + blocks;
+        counter[0] = (uint32_t) block;
+        counter[1] = (uint32_t) (block >> 32);
+        for (z %= 4; z > 0; --z) (*this)();
+    }
+
+    /*
+        Everything that decides the numbers still to come, as STATE_WORDS words, for snapshots (snapshot.h)
+    */
+    static const int STATE_WORDS = 12;
+    void saveState(uint32_t* out) const {
+        for (int i (0); i < 2; ++i) out[i] = key[i];
+        for (int i (0); i < 4; ++i) out[2 + i] = counter[i];
+        for (int i (0); i < 4; ++i) out[6 + i] = output[i];
+        out[10] = (uint32_t) index;
+        out[11] = mirrored;
+    }
+    void loadState(const uint32_t* in) {
+        for (int i (0); i < 2; ++i) key[i] = in[i];
+        for (int i (0); i < 4; ++i) counter[i] = in[2 + i];
+        for (int i (0); i < 4; ++i) output[i] = in[6 + i];
+        index = (int) in[10];
+        mirrored = in[11];
+    }
+
+    /*
+        The ten Philox rounds for one counter
+    */
+    static void block(const uint32_t key_in[2], const uint32_t counter_in[4], uint32_t out[4]) {
+        uint32_t c[4] = {counter_in[0], counter_in[1], counter_in[2], counter_in[3]};
+        uint32_t k[2] = {key_in[0], key_in[1]};
+        for (int round (0); round < 10; ++round) {
+            if (round > 0) {
+                k[0] += 0x9E3779B9;
+                k[1] += 0xBB67AE85;
+            }
+            uint64_t p0 = (uint64_t) 0xD2511F53 * c[0];
+            uint64_t p1 = (uint64_t) 0xCD9E8D57 * c[2];
+            uint32_t next[4] = {(uint32_t) (p1 >> 32) ^ c[1] ^ k[0], (uint32_t) p1, (uint32_t) (p0 >> 32) ^ c[3] ^ k[1], (uint32_t) p0};
+            c[0] = next[0];
+            c[1] = next[1];
+            c[2] = next[2];
+            c[3] = next[3];
+        }
+        for (int i (0); i < 4; ++i) out[i] = c[i];
+    }
+
+private:
+    void generateBlock() {
+        block(key, counter, output);
+        for (uint32_t& word : output) word ^= mirrored;
+        if (++counter[0] == 0) ++counter[1]; //the low 64 bits of the counter count blocks
+    }
+
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t output[4];
+    int index;
+    uint32_t mirrored; //all ones for an antithetic stream, else 0
+};
+
+/*
+    n_blocks consecutive blocks starting at counter, written one after the other to out (4 * n_blocks words). Since
+    every block only depends on the key and its own counter, eight of them can go through the rounds side by side in
+    the 32-bit lanes of an AVX2 register. The result is the same either way; the AVX2 version is used when the CPU
+    has it, which we check once.
+*/
+inline void philoxBlocksScalar(const uint32_t key[2], const uint32_t counter[4], std::size_t n_blocks, uint32_t* out) {
+    uint64_t first = (uint64_t) counter[1] << 32 | counter[0];
+    for (std::size_t b (0); b < n_blocks; ++b) {
+        uint64_t n = first + b;
+        uint32_t c[4] = {(uint32_t) n, (uint32_t) (n >> 32), counter[2], counter[3]};
+        RandomStream::block(key, c, out + 4 * b);
+    }
+}
+
+#ifdef RNG_HAVE_AVX2
+/*
+    32 x 32 -> 64 bit products of all eight lanes: _mm256_mul_epu32 only multiplies the even lanes, so the odd lanes
+    are shifted down and done separately, then the halves are blended back together
+*/
+__attribute__((target("avx2")))
+inline void mulHiLo(__m256i a, __m256i m, __m256i& hi, __m256i& lo) {
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+__attribute__((target("avx2")))
+inline void philoxBlocksAvx2(const uint32_t key[2], const uint32_t counter[4], std::size_t n_blocks, uint32_t* out) {
+    const __m256i m0 = _mm256_set1_epi32((int) 0xD2511F53);
+    const __m256i m1 = _mm256_set1_epi32((int) 0xCD9E8D57);
+    const __m256i bump0 = _mm256_set1_epi32((int) 0x9E3779B9);
+    const __m256i bump1 = _mm256_set1_epi32((int) 0xBB67AE85);
+    uint64_t first = (uint64_t) counter[1] << 32 | counter[0];
+    std::size_t b = 0;
+    for (; b + 8 <= n_blocks; b += 8) {
+        alignas(32) uint32_t low[8], high[8];
+        for (int j (0); j < 8; ++j) {
+            uint64_t n = first + b + j;
+            low[j] = (uint32_t) n;
+            high[j] = (uint32_t) (n >> 32);
+        }
+        __m256i c0 = _mm256_load_si256((const __m256i*) low);
+        __m256i c1 = _mm256_load_si256((const __m256i*) high);
+        __m256i c2 = _mm256_set1_epi32((int) counter[2]);
+        __m256i c3 = _mm256_set1_epi32((int) counter[3]);
+        __m256i k0 = _mm256_set1_epi32((int) key[0]);
+        __m256i k1 = _mm256_set1_epi32((int) key[1]);
+        for (int round (0); round < 10; ++round) {
+            if (round > 0) {
+                k0 = _mm256_add_epi32(k0, bump0);
+                k1 = _mm256_add_epi32(k1, bump1);
+            }
+            __m256i hi0, lo0, hi1, lo1;
+            mulHiLo(c0, m0, hi0, lo0);
+            mulHiLo(c2, m1, hi1, lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+            c3 = lo0;
+        }
+        //transpose from one register per word to four words per block
+        __m256i t0 = _mm256_unpacklo_epi32(c0, c1); //words 0 and 1 of blocks 0, 1, 4, 5
+        __m256i t1 = _mm256_unpackhi_epi32(c0, c1); //blocks 2, 3, 6, 7
+        __m256i t2 = _mm256_unpacklo_epi32(c2, c3); //words 2 and 3
+        __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+        __m256i b04 = _mm256_unpacklo_epi64(t0, t2); //all four words of blocks 0 and 4
+        __m256i b15 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i b26 = _mm256_unpacklo_epi64(t1, t3);
+        __m256i b37 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i* dst = (__m256i*) (out + 4 * b);
+        _mm256_storeu_si256(dst + 0, _mm256_permute2x128_si256(b04, b15, 0x20)); //blocks 0, 1
+        _mm256_storeu_si256(dst + 1, _mm256_permute2x128_si256(b26, b37, 0x20)); //blocks 2, 3
+        _mm256_storeu_si256(dst + 2, _mm256_permute2x128_si256(b04, b15, 0x31)); //blocks 4, 5
+        _mm256_storeu_si256(dst + 3, _mm256_permute2x128_si256(b26, b37, 0x31)); //blocks 6, 7
+    }
+    if (b < n_blocks) {
+        uint64_t n = first + b;
+        uint32_t rest[4] = {(uint32_t) n, (uint32_t) (n >> 32), counter[2], counter[3]};
+        philoxBlocksScalar(key, rest, n_blocks - b, out + 4 * b);
+    }
+}
+#endif
+
+inline void philoxBlocks(const uint32_t key[2], const uint32_t counter[4], std::size_t n_blocks, uint32_t* out) {
+#ifdef RNG_HAVE_AVX2
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        philoxBlocksAvx2(key, counter, n_blocks, out);
+        return;
+    }
+#endif
+    philoxBlocksScalar(key, counter, n_blocks, out);
+}
+
+/*
+    Mix several ids into one stream id, e.g. streamId(iteration, day) for a stream used only on one day of one iteration
+*/
+inline uint64_t streamId(uint64_t a, uint64_t b = 0, uint64_t c = 0) {
+    uint64_t h = a;
+    for (uint64_t x : {b, c}) {
+        h ^= x + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+        h ^= h >> 31;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/*
+    What a substream is for, so that streams for different purposes never coincide
+*/
+enum StreamPurpose : uint64_t {
+    STREAM_SWEEP = 1, //daily trip draws of one chunk of agents
+    STREAM_DESTINATIONS = 2, //destination draws of one chunk of agents
+    STREAM_BIKERS = 3, //bike willingness draws of one chunk of agents
+    STREAM_TRIP_STARTS = 4, //event engine: when one agent at home next starts a trip, searching from one day
+    STREAM_TRIP_LENGTHS = 5, //event engine: the length of the trip one agent starts on one day
+    STREAM_COHORT_TRIPS = 6, //cohort engine: the trips that start in one cell on one day
+    STREAM_COHORT_QUEUES = 7, //cohort engine: who balks at and who boards one queue on one day
+    STREAM_SCENARIO = 8 //the days of one scenario, when scenarios do not share their random numbers
+};
+
+inline RandomStream RandomStream::substream(uint64_t purpose, uint64_t a, uint64_t b) const {
+    uint64_t stream = (uint64_t) counter[3] << 32 | counter[2];
+    RandomStream sub (0, streamId(streamId(stream, purpose), a, b));
+    sub.key[0] = key[0];
+    sub.key[1] = key[1];
+    if (mirrored) return sub.antithetic();
+    return sub;
+}
+
+#endif // RNG_H
@@ -0,0 +1,98 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+/*
+    Batch samplers for the daily sweep. Instead of calling a std:: distribution for every agent, a chunk of agents gets
+    one 32-bit uniform each from RandomStream::fill, and the kernels below turn the whole array into draws with nothing
+    but integer comparisons. The loops have no branches, so the compiler vectorizes them.
+    A probability p becomes the threshold p * 2^32: a uniform below it is a success. For a categorical draw the
+    thresholds are the cumulative probabilities, and the category is the number of thresholds the uniform is not below.
+    These are exact up to the 2^-32 rounding of the thresholds.
+*/
+
+inline uint32_t probabilityThreshold(double p) {
+    if (p <= 0.0) return 0;
+    if (p >= 1.0) return UINT32_MAX; //off by 2^-32, which nothing in the model can tell apart from certainty
+    return (uint32_t) (p * 4294967296.0);
+}
+
+/*
+    hit[i] = 1 with probability p (threshold = probabilityThreshold(p)), otherwise 0
+*/
+inline void sampleBernoulli(const uint32_t* uniforms, std::size_t n, uint32_t threshold, uint8_t* hit) {
+    for (std::size_t i (0); i < n; ++i) hit[i] = uniforms[i] < threshold;
+}
+
+class CategoricalSampler {
+public:
+    /*
+        Category c with probability weights[c] / sum of the weights
+    */
+    explicit CategoricalSampler(const std::vector<double>& weights) {
+        double total = 0.0;
+        for (double w : weights) total += w;
+        double cumulative = 0.0;
+        for (std::size_t c (0); c + 1 < weights.size(); ++c) {
+            cumulative += weights[c];
+            bounds.push_back(probabilityThreshold(cumulative / total));
+        }
+    }
+    std::size_t categories() const {
+        return bounds.size() + 1;
+    }
+    /*
+        One draw. The first categories are the likely ones for everything we use this for, so a linear search is fine.
+    */
+    int operator()(uint32_t uniform) const {
+        int c = 0;
+        while (c < (int) bounds.size() && uniform >= bounds[c]) ++c;
+        return c;
+    }
+    /*
+        A whole array of draws, one pass per threshold. Meant for a handful of categories, like the destinations.
+    */
+    void sample(const uint32_t* uniforms, std::size_t n, uint8_t* category) const {
+        for (std::size_t i (0); i < n; ++i) category[i] = 0;
+        for (uint32_t bound : bounds) {
+            for (std::size_t i (0); i < n; ++i) category[i] += uniforms[i] >= bound;
+        }
+    }
+
+private:
+    std::vector<uint32_t> bounds;
+};
+
+/*
+    Trip lengths 1 .. max_days given that the trip is at least a day long: Poisson(mean) without the 0, with everything
+    past max_days lumped into max_days. Category c is a trip of c + 1 days.
+*/
+inline CategoricalSampler zeroTruncatedPoisson(double mean, int max_days) {
+    std::vector<double> pmf;
+    double p = std::exp(-mean);
+    double tail = 1.0 - p;
+    for (int L (1); L <= max_days; ++L) {
+        p *= mean / L;
+        pmf.push_back(L == max_days ? std::max(tail, 0.0) : p);
+        tail -= p;
+    }
+    return CategoricalSampler(pmf);
+}
+
+/*
+    Scratch arrays for one chunk of agents, kept from day to day so the sweep does not allocate
+*/
+struct SampleBuffers {
+    std::vector<uint32_t> uniforms;
+    std::vector<uint8_t> draws;
+    void resize(std::size_t n) {
+        uniforms.resize(n);
+        draws.resize(n);
+    }
+};
+
+#endif // SAMPLING_H
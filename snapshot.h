@@ -0,0 +1,209 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "agents.h"
+#include "mapped_file.h"
+/*
+    __SNAPSHOTS__
+    The whole state of an AgentModel after some number of days, in one binary file: the packed agents, the four ferry
+    queues, the trip and balk counters, the random stream, and the cumulative trips of the days so far. The file is
+    laid out so it can be memory-mapped and used in place:
+
+        SnapshotHeader (magic "FERRYSNP", version, where it came from, the counters and the queue lengths)
+        places[n_agents], trip_days[n_agents] (uint8), padding to 8 bytes
+        the agents in each queue, front to back, queue by queue (uint32)
+        car trips to the coast, then bike trips to the coast, for days 0 .. day - 1 (int32)
+
+    in the byte order of the machine that wrote it. Loading maps the file and copies the arrays straight into the
+    model, so there is nothing to parse. Snapshots are written to a temporary file that is renamed when complete, so a
+    run that crashes never leaves half a snapshot behind.
+*/
+
+const char SNAPSHOT_MAGIC[8] = {'F', 'E', 'R', 'R', 'Y', 'S', 'N', 'P'};
+const uint32_t SNAPSHOT_VERSION (3); //3: trip lengths are keyed to the agent and the stream state has a word more
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t iteration;
+    uint64_t seed;
+    uint32_t day; //the next day to simulate
+    uint32_t bike_path;
+    float p_bike_if_lane;
+    float p_always_bike;
+    int32_t ferries_per_day;
+    int32_t cars_per_ferry;
+    int32_t bikes_per_ferry;
+    int32_t balk_length;
+    uint32_t rng[RandomStream::STATE_WORDS];
+    uint32_t antithetic;
+    uint32_t padding;
+    uint64_t n_agents;
+    int64_t trips[N_QUEUES];
+    int64_t balked[N_QUEUES];
+    uint64_t queue_length[N_QUEUES];
+};
+static_assert(sizeof(SnapshotHeader) % 8 == 0, "the agent arrays should start 8-byte aligned");
+
+inline bool sameScenario(const Scenario& a, const Scenario& b) {
+    return a.bike_path == b.bike_path && a.p_bike_if_lane == b.p_bike_if_lane && a.p_always_bike == b.p_always_bike
+        && a.ferries_per_day == b.ferries_per_day && a.cars_per_ferry == b.cars_per_ferry
+        && a.bikes_per_ferry == b.bikes_per_ferry && a.balk_length == b.balk_length;
+}
+
+class Snapshot {
+public:
+    /*
+        Where a snapshot came from: the master seed, the iteration, how many days have been simulated and with which
+        parameters, and whether the iteration is the antithetic twin of the one before it (see runScenarios). A run only
+        reuses a snapshot whose Info is exactly the one it would have made itself.
+    */
+    struct Info {
+        uint64_t seed = 0;
+        int iteration = 0;
+        bool antithetic = false;
+        int day = 0;
+        Scenario scenario;
+    };
+
+    /*
+        Save model after info.day days, with the cumulative trips of those days
+    */
+    static void save(const std::string& path, const AgentModel& model, const Info& info, const int* car_trips,
+        const int* bike_trips) {
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof header);
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+        header.version = SNAPSHOT_VERSION;
+        header.iteration = (uint32_t) info.iteration;
+        header.antithetic = info.antithetic;
+        header.seed = info.seed;
+        header.day = (uint32_t) info.day;
+        header.bike_path = (uint32_t) info.scenario.bike_path;
+        header.p_bike_if_lane = info.scenario.p_bike_if_lane;
+        header.p_always_bike = info.scenario.p_always_bike;
+        header.ferries_per_day = info.scenario.ferries_per_day;
+        header.cars_per_ferry = info.scenario.cars_per_ferry;
+        header.bikes_per_ferry = info.scenario.bikes_per_ferry;
+        header.balk_length = info.scenario.balk_length;
+        model.randomizer.saveState(header.rng);
+        const Population& people = model.british_columbia;
+        header.n_agents = people.size();
+        for (int q (0); q < N_QUEUES; ++q) {
+            header.trips[q] = model.trips[q];
+            header.balked[q] = model.balked[q];
+            header.queue_length[q] = model.ferry_queues[q].size();
+        }
+
+        std::string partial = path + ".tmp";
+        {
+            std::ofstream out(partial, std::ios::binary);
+            if (!out) throw std::runtime_error("Could not open the snapshot " + partial);
+            out.write((const char*) &header, sizeof header);
+            out.write((const char*) people.placeData(), people.size());
+            out.write((const char*) people.tripData(), people.size());
+            const char zeros[8] = {};
+            out.write(zeros, padded(2 * people.size()) - 2 * people.size());
+            std::vector<uint32_t> agents;
+            for (int q (0); q < N_QUEUES; ++q) {
+                const PassengerQueue& queue = model.ferry_queues[q];
+                agents.resize(queue.size());
+                for (std::size_t i (0); i < queue.size(); ++i) agents[i] = queue[i];
+                out.write((const char*) agents.data(), agents.size() * sizeof(uint32_t));
+            }
+            for (const int* history : {car_trips, bike_trips}) {
+                for (int t (0); t < info.day; ++t) {
+                    int32_t trips = history[t];
+                    out.write((const char*) &trips, sizeof trips);
+                }
+            }
+            if (!out) throw std::runtime_error("Writing the snapshot " + partial + " failed");
+        }
+        if (std::rename(partial.c_str(), path.c_str()) != 0) throw std::runtime_error("Could not rename " + partial + " to " + path);
+    }
+
+    /*
+        Map a snapshot file and check that it is complete
+    */
+    explicit Snapshot(const std::string& path) : file(path) {
+        if (file.size() < sizeof(SnapshotHeader)) throw std::runtime_error(path + " is not a snapshot");
+        header = (const SnapshotHeader*) file.data();
+        if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof header->magic) != 0) throw std::runtime_error(path + " is not a snapshot");
+        if (header->version != SNAPSHOT_VERSION) {
+            throw std::runtime_error(path + " has snapshot format version " + std::to_string(header->version));
+        }
+        uint64_t queued = 0;
+        for (int q (0); q < N_QUEUES; ++q) queued += header->queue_length[q];
+        queue_offset = sizeof(SnapshotHeader) + padded(2 * header->n_agents);
+        history_offset = queue_offset + queued * sizeof(uint32_t);
+        if (file.size() != history_offset + 2 * (std::size_t) header->day * sizeof(int32_t)) {
+            throw std::runtime_error(path + " is not a complete snapshot");
+        }
+    }
+
+    Info info() const {
+        Info info;
+        info.seed = header->seed;
+        info.iteration = (int) header->iteration;
+        info.antithetic = header->antithetic != 0;
+        info.day = (int) header->day;
+        info.scenario.bike_path = (char) header->bike_path;
+        info.scenario.p_bike_if_lane = header->p_bike_if_lane;
+        info.scenario.p_always_bike = header->p_always_bike;
+        info.scenario.ferries_per_day = header->ferries_per_day;
+        info.scenario.cars_per_ferry = header->cars_per_ferry;
+        info.scenario.bikes_per_ferry = header->bikes_per_ferry;
+        info.scenario.balk_length = header->balk_length;
+        return info;
+    }
+    bool matches(const Info& wanted) const {
+        Info mine = info();
+        return mine.seed == wanted.seed && mine.iteration == wanted.iteration && mine.antithetic == wanted.antithetic && mine.day == wanted.day
+            && sameScenario(mine.scenario, wanted.scenario);
+    }
+
+    /*
+        The model as it was saved, and the cumulative trips of its first info().day days in car_trips and bike_trips
+    */
+    AgentModel restore(int n_threads, int* car_trips, int* bike_trips) const {
+        const uint8_t* agents = (const uint8_t*) file.data() + sizeof(SnapshotHeader);
+        Population people;
+        people.assign(agents, agents + header->n_agents, header->n_agents);
+        RandomStream randomizer (0, 0);
+        randomizer.loadState(header->rng);
+        AgentModel model(std::move(people), info().scenario, randomizer, n_threads);
+        const uint32_t* queued = (const uint32_t*) (file.data() + queue_offset);
+        for (int q (0); q < N_QUEUES; ++q) {
+            model.ferry_queues[q].append(queued, header->queue_length[q]);
+            queued += header->queue_length[q];
+            model.trips[q] = header->trips[q];
+            model.balked[q] = header->balked[q];
+        }
+        const int32_t* history = (const int32_t*) (file.data() + history_offset);
+        for (uint32_t t (0); t < header->day; ++t) {
+            car_trips[t] = history[t];
+            bike_trips[t] = history[header->day + t];
+        }
+        return model;
+    }
+
+private:
+    static std::size_t padded(std::size_t n) {
+        return (n + 7) & ~(std::size_t) 7;
+    }
+
+    MappedFile file;
+    const SnapshotHeader* header;
+    std::size_t queue_offset;
+    std::size_t history_offset;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,270 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+#include <limits>
+#include <ostream>
+#include <vector>
+/*
+    __STATISTICS ACROSS ITERATIONS__
+    Instead of keeping every iteration's numbers until the end and averaging them afterwards, each iteration is folded
+    into running summaries as soon as it is done: Welford's mean and variance, 95% confidence intervals for the mean,
+    and the 5%, 50% and 95% quantiles with the P² algorithm of Jain and Chlamtac (1985), which tracks a quantile with
+    five markers instead of storing the data. Memory does not grow with the number of iterations.
+    The results are folded in iteration order, so they do not depend on which thread finished first. P² is an estimate
+    (exact up to the fifth value, then usually within a fraction of the spread); the mean and the interval are exact.
+    With antithetic pairs (see runScenarios in main.cpp) the two iterations of a pair are not independent, so the mean,
+    the standard deviation and the interval are those of the pair averages, which are; the quantiles still see every
+    iteration, since each one on its own is an ordinary draw.
+    The same summaries of the paired differences between a scenario and its baseline, iteration by iteration, give the
+    comparisons (main): with common random numbers the two runs of an iteration share most of their noise, so the
+    interval of the difference is much narrower than that of either run.
+*/
+
+const int STATS_ROUND (8); //iterations per round with a precision target, and per block of the output table, see main
+
+/*
+    The 97.5% quantile of Student's t with df degrees of freedom, for two-sided 95% intervals. Table up to 30, then the
+    Cornish-Fisher expansion around the normal quantile, which is good to about 1e-4 there.
+*/
+inline double studentT975(long df) {
+    static const double table[31] = {0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179,
+        2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df <= 0) return std::numeric_limits<double>::infinity();
+    if (df <= 30) return table[df];
+    const double z = 1.959964;
+    double n = (double) df;
+    return z + (z * z * z + z) / (4 * n) + (5 * std::pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * n * n);
+}
+
+class RunningStats {
+public:
+    void add(double x) {
+        ++n;
+        double delta = x - running_mean;
+        running_mean += delta / n;
+        m2 += delta * (x - running_mean);
+    }
+    long count() const {
+        return n;
+    }
+    double mean() const {
+        return running_mean;
+    }
+    double variance() const {
+        return n > 1 ? m2 / (n - 1) : 0.0;
+    }
+    double stddev() const {
+        return std::sqrt(variance());
+    }
+    /*
+        Half the width of the 95% confidence interval for the mean; infinite with fewer than two values
+    */
+    double halfWidth() const {
+        if (n < 2) return std::numeric_limits<double>::infinity();
+        return studentT975(n - 1) * stddev() / std::sqrt((double) n);
+    }
+
+private:
+    long n = 0;
+    double running_mean = 0.0;
+    double m2 = 0.0;
+};
+
+class P2Quantile {
+public:
+    explicit P2Quantile(double quantile) : p(quantile) {}
+
+    void add(double x) {
+        if (count < 5) {
+            height[count++] = x;
+            if (count == 5) {
+                std::sort(height, height + 5);
+                for (int i (0); i < 5; ++i) position[i] = i;
+                const double desired_start[5] = {0.0, 2 * p, 4 * p, 2 + 2 * p, 4.0};
+                const double step[5] = {0.0, p / 2, p, (1 + p) / 2, 1.0};
+                for (int i (0); i < 5; ++i) {
+                    desired[i] = desired_start[i];
+                    increment[i] = step[i];
+                }
+            }
+            return;
+        }
+        int k; //the cell height[k] <= x < height[k + 1] the new value falls in
+        if (x < height[0]) {
+            height[0] = x;
+            k = 0;
+        }
+        else if (x >= height[4]) {
+            height[4] = x;
+            k = 3;
+        }
+        else {
+            k = 0;
+            while (x >= height[k + 1]) ++k;
+        }
+        for (int i (k + 1); i < 5; ++i) position[i] += 1;
+        for (int i (0); i < 5; ++i) desired[i] += increment[i];
+        //move the middle markers towards where they should be, by one position at most
+        for (int i (1); i <= 3; ++i) {
+            double d = desired[i] - position[i];
+            if ((d >= 1 && position[i + 1] - position[i] > 1) || (d <= -1 && position[i - 1] - position[i] < -1)) {
+                int s = d >= 0 ? 1 : -1;
+                double guess = parabolic(i, s);
+                height[i] = (height[i - 1] < guess && guess < height[i + 1]) ? guess : linear(i, s);
+                position[i] += s;
+            }
+        }
+        ++count;
+    }
+    /*
+        The estimate so far; with fewer than five values it is interpolated from the values themselves
+    */
+    double value() const {
+        if (count == 0) return std::numeric_limits<double>::quiet_NaN();
+        if (count >= 5) return height[2];
+        double sorted[5];
+        for (int i (0); i < count; ++i) {
+            int j (i);
+            for (; j > 0 && sorted[j - 1] > height[i]; --j) sorted[j] = sorted[j - 1];
+            sorted[j] = height[i];
+        }
+        double rank = p * (count - 1);
+        int below = (int) rank;
+        if (below + 1 >= (int) count) return sorted[count - 1];
+        return sorted[below] + (rank - below) * (sorted[below + 1] - sorted[below]);
+    }
+
+private:
+    double parabolic(int i, int s) const {
+        return height[i] + s / (position[i + 1] - position[i - 1])
+            * ((position[i] - position[i - 1] + s) * (height[i + 1] - height[i]) / (position[i + 1] - position[i])
+            + (position[i + 1] - position[i] - s) * (height[i] - height[i - 1]) / (position[i] - position[i - 1]));
+    }
+    double linear(int i, int s) const {
+        return height[i] + s * (height[i + s] - height[i]) / (position[i + s] - position[i]);
+    }
+
+    double p;
+    long count = 0;
+    double height[5] = {}; //the marker heights, which are the first five values until there are five
+    double position[5] = {};
+    double desired[5] = {};
+    double increment[5] = {};
+};
+
+/*
+    Everything we track about one number (e.g. the car trips up to day t) over the iterations
+*/
+class MetricSummary {
+public:
+    void add(double x) {
+        stats.add(x);
+        p05.add(x);
+        median.add(x);
+        p95.add(x);
+    }
+    /*
+        The two iterations of an antithetic pair
+    */
+    void addPair(double x, double y) {
+        stats.add((x + y) / 2);
+        for (double value : {x, y}) {
+            p05.add(value);
+            median.add(value);
+            p95.add(value);
+        }
+    }
+    const RunningStats& moments() const {
+        return stats;
+    }
+    /*
+        mean, standard deviation, confidence interval, 5% quantile, median, 95% quantile, as CSV columns
+    */
+    void writeColumns(std::ostream& out) const {
+        double half = stats.halfWidth();
+        out << stats.mean() << "," << stats.stddev() << ",";
+        if (std::isfinite(half)) out << stats.mean() - half << "," << stats.mean() + half;
+        else out << ",";
+        out << "," << p05.value() << "," << median.value() << "," << p95.value();
+    }
+    /*
+        Whether the confidence interval is within relative_target of scale on either side; scale is the mean itself
+        unless it is given, e.g. the level of the baseline for a difference that could be close to 0
+    */
+    bool isPrecise(double relative_target) const {
+        return isPrecise(relative_target, stats.mean());
+    }
+    bool isPrecise(double relative_target, double scale) const {
+        return stats.count() >= 2 && stats.halfWidth() <= relative_target * std::fabs(scale);
+    }
+
+private:
+    RunningStats stats;
+    P2Quantile p05 {0.05};
+    P2Quantile median {0.5};
+    P2Quantile p95 {0.95};
+};
+
+/*
+    The daily car and bike trips of one scenario over its iterations, or the differences from its baseline. With
+    antithetic pairs the iterations come in pairs, and the first of each pair waits until the second is there.
+*/
+class ScenarioStatistics {
+public:
+    explicit ScenarioStatistics(int t_max, bool antithetic_pairs = false) : car(t_max), bike(t_max), antithetic(antithetic_pairs) {}
+
+    void addIteration(const int* car_trips, const int* bike_trips) {
+        ++n_iterations;
+        if (antithetic && n_iterations % 2 == 1) {
+            pending_car.assign(car_trips, car_trips + car.size());
+            pending_bike.assign(bike_trips, bike_trips + bike.size());
+            return;
+        }
+        for (std::size_t t (0); t < car.size(); ++t) {
+            if (antithetic) {
+                car[t].addPair(pending_car[t], car_trips[t]);
+                bike[t].addPair(pending_bike[t], bike_trips[t]);
+            }
+            else {
+                car[t].add(car_trips[t]);
+                bike[t].add(bike_trips[t]);
+            }
+        }
+    }
+    int iterations() const {
+        return n_iterations;
+    }
+    const MetricSummary& carTrips(int t) const {
+        return car[t];
+    }
+    const MetricSummary& bikeTrips(int t) const {
+        return bike[t];
+    }
+    /*
+        The metrics the early stopping looks at are the totals for the year, the last day of both series
+    */
+    bool isPrecise(double relative_target) const {
+        return car.back().isPrecise(relative_target) && bike.back().isPrecise(relative_target);
+    }
+    /*
+        The same for differences, relative to the totals of the reference (the baseline)
+    */
+    bool isPrecise(double relative_target, const ScenarioStatistics& reference) const {
+        return car.back().isPrecise(relative_target, reference.car.back().moments().mean())
+            && bike.back().isPrecise(relative_target, reference.bike.back().moments().mean());
+    }
+
+private:
+    std::vector<MetricSummary> car;
+    std::vector<MetricSummary> bike;
+    bool antithetic;
+    std::vector<int> pending_car; //the first iteration of an antithetic pair
+    std::vector<int> pending_bike;
+    int n_iterations = 0;
+};
+
+#endif // STATISTICS_H